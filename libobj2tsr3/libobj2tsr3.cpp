@@ -0,0 +1,2009 @@
+#include "libobj2tsr3_detail.h"
+
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <set>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+using std::literals::string_literals::operator""s;
+
+namespace obj2tsr3 {
+
+using namespace detail;
+
+VertexCacheStats detail::AnalyzeVertexCache(const std::vector<size_t>& indices, size_t num_vertices, size_t cache_size) {
+    std::vector<size_t> cache_time(num_vertices, 0);
+    size_t misses = 0;
+
+    for (const auto index : indices) {
+        if (cache_time[index] == 0 || misses - cache_time[index] >= cache_size) {
+            misses++;
+            cache_time[index] = misses;
+        }
+    }
+
+    size_t num_triangles = indices.size() / 3;
+
+    return {
+        num_triangles ? (float)misses / (float)num_triangles : 0.0f,
+        num_vertices ? (float)misses / (float)num_vertices : 0.0f
+    };
+}
+
+void detail::OptimizeVertexCache(std::vector<size_t>& indices, size_t num_vertices, size_t cache_size) {
+    size_t num_triangles = indices.size() / 3;
+    if (num_triangles == 0) return;
+
+    // Vertex to triangle adjacency
+    std::vector<size_t> live(num_vertices, 0);
+    for (size_t i = 0; i < num_triangles * 3; i++) live[indices[i]]++;
+
+    std::vector<size_t> adjacency_offset(num_vertices + 1, 0);
+    for (size_t v = 0; v < num_vertices; v++) adjacency_offset[v + 1] = adjacency_offset[v] + live[v];
+
+    std::vector<size_t> adjacency(num_triangles * 3);
+    {
+        std::vector<size_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+        for (size_t i = 0; i < num_triangles * 3; i++) adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<size_t> cache_time(num_vertices, 0);
+    std::vector<bool> emitted(num_triangles, false);
+    std::vector<size_t> dead_end;
+    std::vector<size_t> candidates;
+    std::vector<size_t> out_indices;
+    out_indices.reserve(num_triangles * 3);
+
+    size_t time = cache_size + 1;
+    size_t scan = 0;
+
+    for (size_t fanning = indices[0]; ; ) {
+        candidates.clear();
+
+        // Emit all remaining triangles around the fanning vertex
+        for (size_t a = adjacency_offset[fanning]; a < adjacency_offset[fanning + 1]; a++) {
+            size_t triangle = adjacency[a];
+            if (emitted[triangle]) continue;
+
+            for (size_t corner = 0; corner < 3; corner++) {
+                size_t v = indices[triangle * 3 + corner];
+
+                out_indices.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+
+                if (time - cache_time[v] > cache_size) cache_time[v] = time++;
+            }
+
+            emitted[triangle] = true;
+        }
+
+        // Prefer the candidate still in cache that will stay there the longest
+        size_t next = num_vertices;
+        int best_priority = -1;
+
+        for (const auto v : candidates) {
+            if (live[v] == 0) continue;
+
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size) priority = (int)(time - cache_time[v]);
+
+            if (priority > best_priority) {
+                best_priority = priority;
+                next = v;
+            }
+        }
+
+        // Dead end, go back to a recently used vertex or continue the input scan
+        while (next == num_vertices && !dead_end.empty()) {
+            size_t v = dead_end.back();
+            dead_end.pop_back();
+            if (live[v] > 0) next = v;
+        }
+
+        for (; next == num_vertices && scan < num_vertices; scan++)
+            if (live[scan] > 0) next = scan;
+
+        if (next == num_vertices) break;
+        fanning = next;
+    }
+
+    indices.swap(out_indices);
+}
+
+namespace {
+
+// OBJ corner (position / uv / normal index triple) to IA index map
+struct CornerTable {
+    struct Slot {
+        uint32_t key[3]; // key[0] == 0 marks an empty slot, OBJ indices are 1-based
+        uint32_t index;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    // Returns the slot holding key, or the empty slot where it belongs
+    Slot& Lookup(const uint32_t key[3]) {
+        // Keep load factor at most 1/2
+        if ((count + 1) * 2 > slots.size())
+            Grow(std::max<size_t>(64, slots.size() * 2));
+
+        size_t mask = slots.size() - 1;
+
+        for (size_t slot = Hash(key) & mask; ; slot = (slot + 1) & mask) {
+            auto& entry = slots[slot];
+            if (entry.key[0] == 0) return entry;
+            if (entry.key[0] == key[0] && entry.key[1] == key[1] && entry.key[2] == key[2]) return entry;
+        }
+    }
+
+    void Insert(Slot& slot, const uint32_t key[3], size_t index) {
+        slot.key[0] = key[0];
+        slot.key[1] = key[1];
+        slot.key[2] = key[2];
+        slot.index = (uint32_t)index;
+        count++;
+    }
+
+private:
+    static size_t Hash(const uint32_t key[3]) {
+        uint64_t hash = key[0] * 0x9e3779b97f4a7c15ull;
+        hash ^= (hash >> 29) ^ (key[1] * 0xc2b2ae3d27d4eb4full);
+        hash ^= (hash >> 32) ^ (key[2] * 0x165667b19e3779f9ull);
+        hash ^= hash >> 29;
+
+        return (size_t)hash;
+    }
+
+    void Grow(size_t table_size) {
+        std::vector<Slot> old_slots(table_size, Slot{ { 0, 0, 0 }, 0 });
+        old_slots.swap(slots);
+
+        size_t mask = table_size - 1;
+
+        for (const auto& entry : old_slots) {
+            if (entry.key[0] == 0) continue;
+
+            size_t slot = Hash(entry.key) & mask;
+            while (slots[slot].key[0] != 0) slot = (slot + 1) & mask;
+            slots[slot] = entry;
+        }
+    }
+};
+
+// Render mesh of a single material
+struct Material {
+    IndexedArray<8> mesh;
+    CornerTable corners;
+
+    // Repeated corners reuse their index, new ones go through the float dedup of mesh
+    template<typename MakeVertex>
+    void OutCorner(const uint32_t key[3], MakeVertex make_vertex) {
+        auto& slot = corners.Lookup(key);
+
+        if (slot.key[0] != 0) {
+            mesh.out_indices.push_back(slot.index);
+            return;
+        }
+
+        mesh.OutVertex(make_vertex());
+        corners.Insert(slot, key, mesh.out_indices.back());
+    }
+};
+
+// Collision mesh, OBJ position indices map straight to IA3 indices
+struct CollisionMesh {
+    IndexedArray<3> mesh;
+    std::vector<uint32_t> position_remap; // OBJ position index - 1 to IA index + 1 (0 is not seen yet)
+
+    // Only the first use of a position goes through the float dedup of mesh,
+    // which still merges equal positions listed under different indices
+    void OutCorner(size_t position_index, const std::vector<Vec<3>>& positions) {
+        if (position_remap.size() < positions.size())
+            position_remap.resize(positions.size(), 0);
+
+        auto& remap = position_remap[position_index - 1];
+
+        if (remap != 0) {
+            mesh.out_indices.push_back(remap - 1);
+            return;
+        }
+
+        mesh.OutVertex(positions[position_index - 1]);
+        remap = (uint32_t)(mesh.out_indices.back() + 1);
+    }
+};
+
+} // namespace
+
+uint64_t HashBytes(std::string_view data) {
+    const uint64_t k0 = 0x9e3779b97f4a7c15ull;
+    const uint64_t k1 = 0xbf58476d1ce4e5b9ull;
+
+    auto Step = [&](uint64_t h, uint64_t word) {
+        h ^= word * k1;
+        return ((h << 31) | (h >> 33)) * k0;
+    };
+
+    uint64_t h = (uint64_t)data.size() * k0;
+    size_t i = 0;
+
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        h = Step(h, word);
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, data.data() + i, data.size() - i);
+    h = Step(h, tail);
+
+    // Final avalanche (splitmix64)
+    h ^= h >> 30;
+    h *= k1;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    return h;
+}
+
+FileView::FileView(const fs::path& file_path) {
+    if (!Map(file_path)) Read(file_path);
+}
+
+FileView::~FileView() {
+#ifdef _WIN32
+    if (data && mapping) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+#else
+    if (mapping) munmap(mapping, size);
+#endif
+}
+
+bool FileView::Map(const fs::path& file_path) {
+    std::error_code ec;
+    if (!fs::is_regular_file(file_path, ec)) return false;
+
+#ifdef _WIN32
+    HANDLE file_handle = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) return false;
+    file = file_handle;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) return false;
+
+    mapping = CreateFileMappingW(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) return false;
+
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) return false;
+
+    size = (size_t)file_size.QuadPart;
+#else
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* address = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) return false;
+
+    madvise(address, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    mapping = address;
+    data = (const char*)address;
+    size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void FileView::Read(const fs::path& file_path) {
+    std::ifstream ifs(file_path, std::ifstream::binary);
+
+    if (!ifs.good()) throw std::runtime_error("Cannot open \""s + file_path.string() + "\""s);
+
+    char chunk[1 << 16];
+    while (ifs.read(chunk, sizeof(chunk)) || ifs.gcount() > 0)
+        buffer.append(chunk, (size_t)ifs.gcount());
+
+    data = buffer.data();
+    size = buffer.size();
+}
+
+std::atomic<bool> Trace::enabled(false);
+
+namespace {
+
+// Recorded events, threads are numbered in order of their first event
+struct TraceEvent {
+    const char* category;
+    std::string name;
+    int64_t begin; // Microseconds since Start
+    int64_t duration;
+    unsigned thread;
+    nlohmann::json args;
+};
+
+std::mutex trace_mutex;
+std::vector<TraceEvent> trace_events;
+std::chrono::steady_clock::time_point trace_start;
+std::atomic<unsigned> trace_threads(0);
+
+unsigned TraceThread() {
+    thread_local unsigned thread = trace_threads++;
+    return thread;
+}
+
+} // namespace
+
+void Trace::Start() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+
+    trace_start = std::chrono::steady_clock::now();
+    TraceThread();
+
+    enabled = true;
+}
+
+void Trace::Record(const char* category, const std::string& name, std::chrono::steady_clock::time_point begin,
+    std::chrono::steady_clock::time_point end, nlohmann::json args) {
+    if (!Enabled()) return;
+
+    unsigned thread = TraceThread();
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+
+    auto Microseconds = [](std::chrono::steady_clock::duration duration) {
+        return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    };
+
+    trace_events.push_back({ category, name, Microseconds(begin - trace_start), Microseconds(end - begin), thread, std::move(args) });
+}
+
+namespace {
+
+// File of the last Save, later saves to it overwrite its closing text at the tail offset
+// with their events. Only Save uses them
+fs::path trace_path;
+std::streamoff trace_tail = 0;
+unsigned trace_named_threads = 0;
+
+} // namespace
+
+void Trace::Save(const fs::path& path) {
+    std::vector<TraceEvent> events;
+    unsigned threads = trace_threads;
+
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        events.swap(trace_events);
+    }
+
+    bool append = !trace_path.empty() && path == trace_path;
+    if (append && events.empty() && trace_named_threads == threads) return;
+
+    std::string text;
+    if (!append) {
+        text = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        trace_named_threads = 0;
+    }
+
+    // Every event but the first of the file follows a comma, the file starts with the lane of the
+    // thread that started the trace
+    auto Put = [&](const nlohmann::json& json_event) {
+        if (append || trace_named_threads) text += ",";
+        text += json_event.dump();
+        text += "\n";
+    };
+
+    for (; trace_named_threads < threads; trace_named_threads++) {
+        unsigned thread = trace_named_threads;
+        Put({ { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", thread },
+            { "args", { { "name", thread == 0 ? "Main"s : "Worker "s + std::to_string(thread) } } } });
+    }
+
+    for (const auto& event : events) {
+        nlohmann::json json_event = {
+            { "name", event.name },
+            { "cat", event.category },
+            { "ph", "X" },
+            { "ts", event.begin },
+            { "dur", event.duration },
+            { "pid", 1 },
+            { "tid", event.thread },
+        };
+
+        if (!event.args.is_null()) json_event["args"] = event.args;
+        Put(json_event);
+    }
+
+    std::fstream file(path, append ? std::ios::in | std::ios::out | std::ios::binary : std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.good()) throw std::runtime_error("Cannot open trace \""s + path.string() + "\" for output"s);
+
+    trace_path.clear();
+    if (append) file.seekp(trace_tail);
+
+    file.write(text.data(), (std::streamsize)text.size());
+    std::streamoff tail = file.tellp();
+    file << "]}\n";
+
+    if (!file.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
+
+    trace_path = path;
+    trace_tail = tail;
+}
+
+PhaseStats& ConvertStats::Phase(const std::string& name) {
+    for (auto& phase : phases)
+        if (phase.name == name) return phase;
+
+    phases.push_back({ name });
+    return phases.back();
+}
+
+void ConvertStats::Print(Log& log) const {
+    log.Printf("%-32s %10s %12s %10s %12s\n", "Phase", "Time (ms)", "Bytes", "Records", "Records/s");
+
+    for (const auto& phase : phases) {
+        double rate = phase.seconds > 0.0 ? (double)phase.records / phase.seconds : 0.0;
+        log.Printf("%-32s %10.3f %12llu %10llu %12.0f\n", phase.name.c_str(), phase.seconds * 1000.0,
+            (unsigned long long)phase.bytes, (unsigned long long)phase.records, rate);
+    }
+
+    log.Printf("%-32s %10.3f\n\n", "Total", seconds * 1000.0);
+
+    log.Printf("Dedup: %llu corners, %llu vertices (%.1f%% hit rate)\n", (unsigned long long)corners, (unsigned long long)unique_vertices, DedupHitRate() * 100.0);
+    log.Printf("Peak memory: %.1f MiB\n", (double)peak_memory / (1024.0 * 1024.0));
+}
+
+nlohmann::json ConvertStats::Json() const {
+    nlohmann::json json;
+
+    auto& json_phases = json["phases"] = nlohmann::json::array();
+    for (const auto& phase : phases) {
+        json_phases.push_back({
+            { "name", phase.name },
+            { "seconds", phase.seconds },
+            { "bytes", phase.bytes },
+            { "records", phase.records },
+            { "records_per_second", phase.seconds > 0.0 ? (double)phase.records / phase.seconds : 0.0 },
+        });
+    }
+
+    json["seconds"] = seconds;
+    json["corners"] = corners;
+    json["unique_vertices"] = unique_vertices;
+    json["dedup_hit_rate"] = DedupHitRate();
+    json["peak_memory"] = peak_memory;
+
+    return json;
+}
+
+size_t PeakMemoryUsage() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss; // Bytes on macOS
+#else
+    return (size_t)usage.ru_maxrss * 1024; // Kilobytes elsewhere
+#endif
+#endif
+}
+
+namespace {
+
+// Part of an OBJ file parsed on its own, OBJ indices are checked when the chunks are stitched in order
+struct ObjChunk {
+    // Commands that depend on the state left by previous chunks, in file order
+    struct Command {
+        enum Type { MtlLib, UseMtl, Faces } type = Faces;
+        std::string name = {};    // MtlLib / UseMtl argument
+        size_t face_begin = 0;    // Faces range
+        size_t face_end = 0;
+        size_t num_positions = 0; // Chunk attribute counts when the faces were read
+        size_t num_uvs = 0;
+        size_t num_normals = 0;
+    };
+
+    std::vector<Vec<3>> positions;
+    std::vector<Vec<2>> uvs;
+    std::vector<Vec<3>> normals;
+    std::vector<std::array<uint32_t, 9>> faces; // v / vt / vn of each corner
+    std::vector<Command> commands;
+
+    void Parse(std::string_view text) {
+        ParseLines(text, [&](std::string_view command, LineCursor& ls) {
+            if (command == "mtllib") {
+                commands.push_back({ Command::MtlLib, std::string(ls.Rest()) });
+            } else if (command == "usemtl") {
+                commands.push_back({ Command::UseMtl, std::string(ls.Rest()) });
+            } else if (command == "v") {
+                Vec<3> v;
+                v[0] = ls.Float();
+                v[1] = ls.Float();
+                v[2] = ls.Float();
+                positions.push_back(v);
+            } else if (command == "vt") {
+                Vec<2> vt;
+                vt[0] = ls.Float();
+                vt[1] = ls.Float();
+                uvs.push_back(vt);
+            } else if (command == "vn") {
+                Vec<3> vn;
+                vn[0] = ls.Float();
+                vn[1] = ls.Float();
+                vn[2] = ls.Float();
+                normals.push_back(vn);
+            } else if (command == "f") {
+                std::array<uint32_t, 9> face;
+
+                for (size_t i = 0; i < 3; i++) {
+                    face[i * 3 + 0] = ClampIndex(ls.Index());
+                    ls.Char();
+                    face[i * 3 + 1] = ClampIndex(ls.Index());
+                    ls.Char();
+                    face[i * 3 + 2] = ClampIndex(ls.Index());
+                }
+
+                // Extend the last face run unless attributes or commands came in between
+                if (commands.empty() || commands.back().type != Command::Faces || commands.back().num_positions != positions.size()
+                    || commands.back().num_uvs != uvs.size() || commands.back().num_normals != normals.size()) {
+                    Command run;
+                    run.face_begin = faces.size();
+                    run.face_end = faces.size();
+                    run.num_positions = positions.size();
+                    run.num_uvs = uvs.size();
+                    run.num_normals = normals.size();
+                    commands.push_back(run);
+                }
+
+                faces.push_back(face);
+                commands.back().face_end = faces.size();
+            }
+        });
+    }
+
+private:
+    // Indices past uint32_t cannot be valid, keep them out of range instead of wrapping
+    static uint32_t ClampIndex(size_t index) {
+        return (uint32_t)std::min<size_t>(index, std::numeric_limits<uint32_t>::max());
+    }
+};
+
+// Parsed chunks by the hash and size of their text
+using ObjChunkCache = std::map<std::pair<uint64_t, size_t>, std::shared_ptr<const ObjChunk>>;
+
+// Split OBJ text into line aligned chunks and parse them in parallel. With a cache, a chunk ends
+// after the first line past the minimum size whose hash says so: an edit only moves the bounds of
+// its own chunk, and chunks found in the cache are not parsed again. The cache is left with the
+// chunks of this text, num_parsed counts the chunks that were parsed
+std::vector<std::shared_ptr<const ObjChunk>> ParseObjChunks(std::string_view text, unsigned threads, ObjChunkCache* cache = nullptr, size_t* num_parsed = nullptr) {
+    const size_t min_chunk_size = 1 << 20;
+    const size_t min_cached_chunk_size = 1 << 18;
+    const size_t max_cached_chunk_size = 1 << 20;
+
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<size_t> bounds = { 0 };
+
+    if (cache) {
+        while (bounds.back() < text.size()) {
+            size_t begin = bounds.back();
+            size_t end = text.size();
+
+            if (text.size() - begin > min_cached_chunk_size) {
+                // Ends of the lines past the minimum size, a chunk holds at least one line
+                for (size_t line = text.find('\n', begin + min_cached_chunk_size); line != std::string_view::npos; ) {
+                    size_t next = text.find('\n', line + 1);
+                    size_t line_end = next == std::string_view::npos ? text.size() : next;
+
+                    if (line_end - begin >= max_cached_chunk_size || (HashBytes(text.substr(line + 1, line_end - line - 1)) & 63) == 0) {
+                        end = std::min(line_end + 1, text.size());
+                        break;
+                    }
+
+                    line = next;
+                }
+            }
+
+            bounds.push_back(end);
+        }
+    } else {
+        size_t num_chunks = std::max<size_t>(1, std::min<size_t>(threads, text.size() / min_chunk_size));
+        bounds.resize(num_chunks + 1, text.size());
+
+        for (size_t i = 1; i < num_chunks; i++) {
+            size_t newline = text.find('\n', std::max(bounds[i - 1], text.size() / num_chunks * i));
+            bounds[i] = newline == std::string_view::npos ? text.size() : newline + 1;
+        }
+    }
+
+    size_t num_chunks = std::max<size_t>(1, bounds.size() - 1);
+    bounds.resize(num_chunks + 1, text.size());
+
+    std::vector<std::shared_ptr<const ObjChunk>> chunks(num_chunks);
+    std::vector<ObjChunkCache::key_type> keys(cache ? num_chunks : 0);
+    std::atomic<size_t> parsed(0);
+
+    ParallelFor(num_chunks, threads, [&](size_t i) {
+        std::string_view chunk_text = text.substr(bounds[i], bounds[i + 1] - bounds[i]);
+
+        if (cache) {
+            keys[i] = { HashBytes(chunk_text), chunk_text.size() };
+
+            auto cached = cache->find(keys[i]);
+            if (cached != cache->end()) {
+                chunks[i] = cached->second;
+                return;
+            }
+        }
+
+        TraceScope trace("parse", "OBJ chunk");
+
+        auto chunk = std::make_shared<ObjChunk>();
+        chunk->Parse(chunk_text);
+        chunks[i] = std::move(chunk);
+        parsed++;
+    });
+
+    if (cache) {
+        cache->clear();
+        for (size_t i = 0; i < num_chunks; i++)
+            cache->emplace(keys[i], chunks[i]);
+    }
+
+    if (num_parsed) *num_parsed = parsed;
+
+    return chunks;
+}
+
+} // namespace
+
+// Parsed chunks of the last conversion, render meshes of the materials and the collision mesh as
+// assembled, before any optimization, and the files that were made of them
+struct ConvertCache::State {
+    struct Material {
+        IndexedArray<8> mesh;
+        size_t parts = 0;
+        std::vector<std::string> files;         // LODs and parts
+        std::vector<std::string> meshlet_files; // Written after every material
+    };
+
+    ObjChunkCache chunks;
+    std::map<std::string, Material> materials;
+    IndexedArray<3> collision_mesh;
+    std::vector<std::string> collision_files;
+    std::vector<std::string> files; // Of the whole conversion, in output order
+};
+
+std::vector<std::string> ConvertCache::Files() const {
+    return state ? state->files : std::vector<std::string>();
+}
+
+namespace {
+
+uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    // Inf / NaN, and values that round past the largest half
+    if (magnitude >= 0x7f800000) return (uint16_t)(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+    if (magnitude >= 0x477ff000) return (uint16_t)(sign | 0x7c00);
+
+    // Subnormal halves, steps of 2^-24
+    if (magnitude < 0x38800000) {
+        float absolute;
+        std::memcpy(&absolute, &magnitude, sizeof(absolute));
+        return (uint16_t)(sign | (uint32_t)std::nearbyint(absolute * 16777216.0f));
+    }
+
+    // Rebias the exponent, round the mantissa to nearest even
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+
+    return (uint16_t)(sign | half);
+}
+
+uint16_t QuantizeUnorm16(float value, float min, float scale) {
+    if (!(scale > 0.0f)) return 0;
+
+    float t = std::min(std::max((value - min) / scale, 0.0f), 1.0f);
+    return (uint16_t)std::lround(t * 65535.0f);
+}
+
+template<typename T>
+T QuantizeSnorm(float value) {
+    const float max = (float)std::numeric_limits<T>::max();
+    return (T)std::lround(std::min(std::max(value, -1.0f), 1.0f) * max);
+}
+
+// Octahedral normal mapping, u and v in [-1, 1]
+void OctahedralEncode(float x, float y, float z, float& u, float& v) {
+    float l1 = std::fabs(x) + std::fabs(y) + std::fabs(z);
+
+    if (!(l1 > 0.0f)) {
+        u = v = 0.0f;
+        return;
+    }
+
+    x /= l1;
+    y /= l1;
+    z /= l1;
+
+    if (z < 0.0f) {
+        u = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        v = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    } else {
+        u = x;
+        v = y;
+    }
+}
+
+} // namespace
+
+QuantizationBlock detail::ComputeQuantization(const std::vector<Vec<8>>& vertices) {
+    QuantizationBlock block = {};
+    if (vertices.empty()) return block;
+
+    float min[5], max[5];
+    for (size_t i = 0; i < 5; i++) min[i] = max[i] = vertices[0][i];
+
+    for (const auto& vertex : vertices) {
+        for (size_t i = 0; i < 5; i++) {
+            min[i] = std::min(min[i], vertex[i]);
+            max[i] = std::max(max[i], vertex[i]);
+        }
+    }
+
+    for (size_t i = 0; i < 3; i++) {
+        block.position_min[i] = min[i];
+        block.position_scale[i] = max[i] - min[i];
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        block.uv_min[i] = min[3 + i];
+        block.uv_scale[i] = max[3 + i] - min[3 + i];
+    }
+
+    return block;
+}
+
+void detail::PutVertices(BlockWriter& writer, const std::vector<Vec<8>>& vertices, const IAFormat& format, const QuantizationBlock& q) {
+    if (format.vertex_format == VertexFormat::Float) {
+        PutVertices<8>(writer, vertices, format, q);
+        return;
+    }
+
+    for (const auto& vertex : vertices) {
+        for (size_t i = 0; i < 3; i++)
+            writer.Put<uint16_t>(QuantizeUnorm16(vertex[i], q.position_min[i], q.position_scale[i]));
+
+        float u, v;
+        OctahedralEncode(vertex[5], vertex[6], vertex[7], u, v);
+
+        if (format.vertex_format == VertexFormat::Q16) {
+            writer.Put<uint16_t>(0);
+            writer.Put<uint16_t>(FloatToHalf(vertex[3]));
+            writer.Put<uint16_t>(FloatToHalf(vertex[4]));
+            writer.Put<int16_t>(QuantizeSnorm<int16_t>(u));
+            writer.Put<int16_t>(QuantizeSnorm<int16_t>(v));
+        } else {
+            writer.Put<uint16_t>(QuantizeUnorm16(vertex[3], q.uv_min[0], q.uv_scale[0]));
+            writer.Put<uint16_t>(QuantizeUnorm16(vertex[4], q.uv_min[1], q.uv_scale[1]));
+            writer.Put<int8_t>(QuantizeSnorm<int8_t>(u));
+            writer.Put<int8_t>(QuantizeSnorm<int8_t>(v));
+        }
+    }
+}
+
+template<size_t size>
+void CreateIA(fs::path path, const IndexedArray<size>& data, const IAFormat& format) {
+    WriteBinaryFile(path, [&](BlockWriter& writer) {
+        WriteIA(writer, data, format);
+    });
+}
+
+template void CreateIA<8>(fs::path path, const IndexedArray<8>& data, const IAFormat& format);
+template void CreateIA<3>(fs::path path, const IndexedArray<3>& data, const IAFormat& format);
+
+BVH BuildBVH(const IndexedArray<3>& mesh, size_t max_leaf_triangles) {
+    const size_t num_bins = 16;
+    const size_t forced_split_triangles = 16;
+
+    size_t num_triangles = mesh.out_indices.size() / 3;
+
+    std::vector<std::array<float, 6>> bounds(num_triangles);
+    std::vector<std::array<float, 3>> centroids(num_triangles);
+
+    for (size_t t = 0; t < num_triangles; t++) {
+        for (size_t axis = 0; axis < 3; axis++) {
+            float a = mesh.out_vertices[mesh.out_indices[t * 3 + 0]][axis];
+            float b = mesh.out_vertices[mesh.out_indices[t * 3 + 1]][axis];
+            float c = mesh.out_vertices[mesh.out_indices[t * 3 + 2]][axis];
+
+            bounds[t][axis] = std::min(a, std::min(b, c));
+            bounds[t][axis + 3] = std::max(a, std::max(b, c));
+            centroids[t][axis] = (bounds[t][axis] + bounds[t][axis + 3]) * 0.5f;
+        }
+    }
+
+    auto Grow = [](std::array<float, 6>& box, const std::array<float, 6>& other) {
+        for (size_t axis = 0; axis < 3; axis++) {
+            box[axis] = std::min(box[axis], other[axis]);
+            box[axis + 3] = std::max(box[axis + 3], other[axis + 3]);
+        }
+    };
+
+    auto Area = [](const std::array<float, 6>& box) {
+        float dx = box[3] - box[0], dy = box[4] - box[1], dz = box[5] - box[2];
+        return dx < 0.0f ? 0.0f : 2.0f * (dx * dy + dy * dz + dz * dx);
+    };
+
+    const float inf = std::numeric_limits<float>::infinity();
+    const std::array<float, 6> empty = { inf, inf, inf, -inf, -inf, -inf };
+
+    std::vector<uint32_t> order(num_triangles);
+    for (size_t t = 0; t < num_triangles; t++) order[t] = (uint32_t)t;
+
+    BVH bvh;
+
+    // No nodes at all for an empty mesh, a leaf never has a zero count
+    if (num_triangles == 0) return bvh;
+
+    // Depth first build, the right half waits on the stack with its parent to patch
+    struct Range {
+        size_t begin, end;
+        size_t parent;
+    };
+
+    const size_t no_parent = std::numeric_limits<size_t>::max();
+    std::vector<Range> stack = { { 0, num_triangles, no_parent } };
+
+    while (!stack.empty()) {
+        Range range = stack.back();
+        stack.pop_back();
+
+        size_t node_index = bvh.nodes.size();
+        bvh.nodes.emplace_back();
+        if (range.parent != no_parent) bvh.nodes[range.parent].offset = (uint32_t)node_index;
+
+        std::array<float, 6> box = empty, centroid_box = empty;
+        for (size_t i = range.begin; i < range.end; i++) {
+            Grow(box, bounds[order[i]]);
+            const auto& c = centroids[order[i]];
+            Grow(centroid_box, { c[0], c[1], c[2], c[0], c[1], c[2] });
+        }
+
+        size_t count = range.end - range.begin;
+
+        // Best binned SAH split over all axes
+        float best_cost = inf;
+        size_t best_axis = 0, best_bin = 0;
+
+        for (size_t axis = 0; axis < 3 && count > max_leaf_triangles; axis++) {
+            float extent = centroid_box[axis + 3] - centroid_box[axis];
+            if (!(extent > 0.0f)) continue;
+
+            std::array<float, 6> bin_boxes[num_bins];
+            size_t bin_counts[num_bins] = {};
+            for (auto& bin_box : bin_boxes) bin_box = empty;
+
+            for (size_t i = range.begin; i < range.end; i++) {
+                size_t bin = std::min(num_bins - 1, (size_t)((centroids[order[i]][axis] - centroid_box[axis]) / extent * num_bins));
+                bin_counts[bin]++;
+                Grow(bin_boxes[bin], bounds[order[i]]);
+            }
+
+            // Right sweep, then left sweep evaluating each split plane
+            float right_areas[num_bins];
+            size_t right_counts[num_bins];
+            std::array<float, 6> right_box = empty;
+            size_t right_count = 0;
+
+            for (size_t bin = num_bins - 1; bin > 0; bin--) {
+                Grow(right_box, bin_boxes[bin]);
+                right_count += bin_counts[bin];
+                right_areas[bin] = Area(right_box);
+                right_counts[bin] = right_count;
+            }
+
+            std::array<float, 6> left_box = empty;
+            size_t left_count = 0;
+
+            for (size_t bin = 0; bin + 1 < num_bins; bin++) {
+                Grow(left_box, bin_boxes[bin]);
+                left_count += bin_counts[bin];
+
+                if (left_count == 0 || right_counts[bin + 1] == 0) continue;
+
+                float cost = Area(left_box) * left_count + right_areas[bin + 1] * right_counts[bin + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = bin;
+                }
+            }
+        }
+
+        float box_area = Area(box);
+        bool split_found = best_cost < inf;
+        bool split_pays = split_found && 1.0f + best_cost / std::max(box_area, 1e-30f) < (float)count;
+
+        auto& node = bvh.nodes[node_index];
+        for (size_t axis = 0; axis < 3; axis++) {
+            node.min[axis] = box[axis];
+            node.max[axis] = box[axis + 3];
+        }
+
+        if (count <= max_leaf_triangles || (!split_pays && count <= forced_split_triangles)) {
+            node.offset = (uint32_t)range.begin;
+            node.count = (uint32_t)count;
+            continue;
+        }
+
+        size_t middle;
+
+        if (split_pays) {
+            float extent = centroid_box[best_axis + 3] - centroid_box[best_axis];
+
+            auto it = std::partition(order.begin() + range.begin, order.begin() + range.end, [&](uint32_t t) {
+                size_t bin = std::min(num_bins - 1, (size_t)((centroids[t][best_axis] - centroid_box[best_axis]) / extent * num_bins));
+                return bin <= best_bin;
+            });
+
+            middle = it - order.begin();
+        } else {
+            // Too many triangles for a leaf but no useful split, halve along the longest axis
+            size_t axis = 0;
+            for (size_t i = 1; i < 3; i++)
+                if (box[i + 3] - box[i] > box[axis + 3] - box[axis]) axis = i;
+
+            middle = range.begin + count / 2;
+            std::nth_element(order.begin() + range.begin, order.begin() + middle, order.begin() + range.end, [&](uint32_t a, uint32_t b) {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+        }
+
+        node.count = 0;
+
+        stack.push_back({ middle, range.end, node_index });
+        stack.push_back({ range.begin, middle, no_parent });
+    }
+
+    // Triangles in leaf order, vertices in order of first use
+    bvh.mesh.out_vertices = mesh.out_vertices;
+    bvh.mesh.out_indices.reserve(num_triangles * 3);
+
+    for (const auto t : order)
+        for (size_t corner = 0; corner < 3; corner++) bvh.mesh.out_indices.push_back(mesh.out_indices[t * 3 + corner]);
+
+    bvh.mesh.OptimizeVertexFetch();
+
+    return bvh;
+}
+
+void detail::WriteBVH(BlockWriter& writer, const BVH& bvh) {
+    const char magic[4] = { 'B', 'V', '3', '\0' };
+    writer.PutBytes(magic, sizeof(magic));
+    writer.Put<uint32_t>(1);
+
+    writer.Put<uint32_t>((uint32_t)bvh.nodes.size());
+    writer.PutBytes(bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode));
+
+    writer.Put<uint32_t>((uint32_t)bvh.mesh.out_vertices.size());
+    writer.PutBytes(bvh.mesh.out_vertices.data(), bvh.mesh.out_vertices.size() * sizeof(Vec<3>));
+
+    writer.Put<uint32_t>((uint32_t)bvh.mesh.out_indices.size());
+    for (const auto index : bvh.mesh.out_indices)
+        writer.Put<uint32_t>((uint32_t)index);
+}
+
+void CreateBVH(fs::path path, const BVH& bvh) {
+    WriteBinaryFile(path, [&](BlockWriter& writer) {
+        WriteBVH(writer, bvh);
+    });
+}
+
+BVH LoadBVH(fs::path path) {
+    FileView file(path);
+    std::string_view data = file.View();
+    size_t offset = 0;
+
+    auto Get = [&](void* out, size_t count) {
+        if (offset + count > data.size()) throw std::runtime_error("Truncated BVH \""s + path.string() + "\""s);
+        std::memcpy(out, data.data() + offset, count);
+        offset += count;
+    };
+
+    auto GetCount = [&]() {
+        uint32_t count;
+        Get(&count, sizeof(count));
+        return (size_t)count;
+    };
+
+    char magic[4];
+    Get(magic, sizeof(magic));
+    if (std::memcmp(magic, "BV3", 4) != 0 || GetCount() != 1) throw std::runtime_error("Not a BVH file \""s + path.string() + "\""s);
+
+    BVH bvh;
+
+    bvh.nodes.resize(GetCount());
+    Get(bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode));
+
+    bvh.mesh.out_vertices.resize(GetCount());
+    Get(bvh.mesh.out_vertices.data(), bvh.mesh.out_vertices.size() * sizeof(Vec<3>));
+
+    bvh.mesh.out_indices.resize(GetCount());
+    for (auto& index : bvh.mesh.out_indices) {
+        uint32_t value;
+        Get(&value, sizeof(value));
+        if (value >= bvh.mesh.out_vertices.size()) throw std::runtime_error("Index out of range in BVH \""s + path.string() + "\""s);
+        index = value;
+    }
+
+    // Inner nodes must point forward to nodes of the file, leaves to triangles of the file
+    size_t num_triangles = bvh.mesh.out_indices.size() / 3;
+
+    for (size_t i = 0; i < bvh.nodes.size(); i++) {
+        const auto& node = bvh.nodes[i];
+        bool valid = node.count > 0 ? (size_t)node.offset + node.count <= num_triangles
+            : i + 1 < bvh.nodes.size() && node.offset > i + 1 && node.offset < bvh.nodes.size();
+
+        if (!valid) throw std::runtime_error("Invalid node in BVH \""s + path.string() + "\""s);
+    }
+
+    return bvh;
+}
+
+float RayQuery(const BVH& bvh, const float origin[3], const float direction[3], float max_distance) {
+    if (bvh.nodes.empty()) return max_distance;
+
+    float inverse[3];
+    for (size_t i = 0; i < 3; i++) inverse[i] = 1.0f / direction[i];
+
+    auto HitBox = [&](const BVHNode& node, float limit) {
+        float near_t = 0.0f, far_t = limit;
+
+        for (size_t i = 0; i < 3; i++) {
+            float t0 = (node.min[i] - origin[i]) * inverse[i];
+            float t1 = (node.max[i] - origin[i]) * inverse[i];
+            if (t0 > t1) std::swap(t0, t1);
+
+            near_t = std::max(near_t, t0);
+            far_t = std::min(far_t, t1);
+        }
+
+        return near_t <= far_t;
+    };
+
+    float closest = max_distance;
+    std::vector<uint32_t> stack = { 0 };
+
+    while (!stack.empty()) {
+        uint32_t node_index = stack.back();
+        stack.pop_back();
+
+        const auto& node = bvh.nodes[node_index];
+        if (!HitBox(node, closest)) continue;
+
+        if (node.count == 0) {
+            stack.push_back(node.offset);
+            stack.push_back(node_index + 1);
+            continue;
+        }
+
+        for (size_t t = node.offset; t < node.offset + node.count; t++) {
+            const auto& a = bvh.mesh.out_vertices[bvh.mesh.out_indices[t * 3 + 0]];
+            const auto& b = bvh.mesh.out_vertices[bvh.mesh.out_indices[t * 3 + 1]];
+            const auto& c = bvh.mesh.out_vertices[bvh.mesh.out_indices[t * 3 + 2]];
+
+            float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            float p[3] = { direction[1] * e2[2] - direction[2] * e2[1], direction[2] * e2[0] - direction[0] * e2[2], direction[0] * e2[1] - direction[1] * e2[0] };
+
+            float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (std::fabs(det) < 1e-12f) continue;
+
+            float inv_det = 1.0f / det;
+            float s[3] = { origin[0] - a[0], origin[1] - a[1], origin[2] - a[2] };
+            float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+            if (u < 0.0f || u > 1.0f) continue;
+
+            float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+            float v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inv_det;
+            if (v < 0.0f || u + v > 1.0f) continue;
+
+            float t_hit = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+            if (t_hit >= 0.0f && t_hit < closest) closest = t_hit;
+        }
+    }
+
+    return closest;
+}
+
+size_t AabbQuery(const BVH& bvh, const float min[3], const float max[3], std::vector<uint32_t>& triangles) {
+    triangles.clear();
+    if (bvh.nodes.empty()) return 0;
+
+    auto Overlaps = [&](const float box_min[3], const float box_max[3]) {
+        for (size_t i = 0; i < 3; i++)
+            if (box_min[i] > max[i] || box_max[i] < min[i]) return false;
+        return true;
+    };
+
+    std::vector<uint32_t> stack = { 0 };
+
+    while (!stack.empty()) {
+        uint32_t node_index = stack.back();
+        stack.pop_back();
+
+        const auto& node = bvh.nodes[node_index];
+        if (!Overlaps(node.min, node.max)) continue;
+
+        if (node.count == 0) {
+            stack.push_back(node.offset);
+            stack.push_back(node_index + 1);
+            continue;
+        }
+
+        for (uint32_t t = node.offset; t < node.offset + node.count; t++) {
+            float triangle_min[3], triangle_max[3];
+
+            for (size_t i = 0; i < 3; i++) {
+                float a = bvh.mesh.out_vertices[bvh.mesh.out_indices[t * 3 + 0]][i];
+                float b = bvh.mesh.out_vertices[bvh.mesh.out_indices[t * 3 + 1]][i];
+                float c = bvh.mesh.out_vertices[bvh.mesh.out_indices[t * 3 + 2]][i];
+                triangle_min[i] = std::min(a, std::min(b, c));
+                triangle_max[i] = std::max(a, std::max(b, c));
+            }
+
+            if (Overlaps(triangle_min, triangle_max)) triangles.push_back(t);
+        }
+    }
+
+    return triangles.size();
+}
+
+namespace {
+
+MeshletBounds ComputeMeshletBounds(const IndexedArray<8>& mesh, const MeshletData& data, const Meshlet& meshlet) {
+    MeshletBounds bounds = {};
+
+    auto Position = [&](size_t local) -> const Vec<8>& {
+        return mesh.out_vertices[data.vertices[meshlet.vertex_offset + local]];
+    };
+
+    auto Distance = [](const Vec<8>& v, const float p[3]) {
+        return std::sqrt((v[0] - p[0]) * (v[0] - p[0]) + (v[1] - p[1]) * (v[1] - p[1]) + (v[2] - p[2]) * (v[2] - p[2]));
+    };
+
+    // Bounding sphere (Ritter 1990), from the two far apart points then grown to cover the rest
+    size_t a = 0, b = 0;
+    float start[3] = { Position(0)[0], Position(0)[1], Position(0)[2] };
+
+    for (size_t i = 0; i < meshlet.vertex_count; i++)
+        if (Distance(Position(i), start) > Distance(Position(a), start)) a = i;
+
+    float from_a[3] = { Position(a)[0], Position(a)[1], Position(a)[2] };
+    for (size_t i = 0; i < meshlet.vertex_count; i++)
+        if (Distance(Position(i), from_a) > Distance(Position(b), from_a)) b = i;
+
+    for (size_t i = 0; i < 3; i++) bounds.center[i] = (Position(a)[i] + Position(b)[i]) * 0.5f;
+    bounds.radius = Distance(Position(a), bounds.center);
+
+    for (size_t i = 0; i < meshlet.vertex_count; i++) {
+        float distance = Distance(Position(i), bounds.center);
+        if (distance <= bounds.radius) continue;
+
+        float new_radius = (bounds.radius + distance) * 0.5f;
+        float shift = (new_radius - bounds.radius) / distance;
+
+        for (size_t k = 0; k < 3; k++) bounds.center[k] += (Position(i)[k] - bounds.center[k]) * shift;
+        bounds.radius = new_radius;
+    }
+
+    // Normal cone around the area weighted mean of the triangle normals
+    std::vector<std::array<float, 3>> normals;
+    float axis[3] = {};
+
+    for (size_t t = 0; t < meshlet.triangle_count; t++) {
+        const uint8_t* corners = &data.triangles[meshlet.triangle_offset + t * 3];
+        const auto& p0 = Position(corners[0]);
+        const auto& p1 = Position(corners[1]);
+        const auto& p2 = Position(corners[2]);
+
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+
+        float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (!(length > 0.0f)) continue;
+
+        for (size_t k = 0; k < 3; k++) axis[k] += n[k];
+        normals.push_back({ n[0] / length, n[1] / length, n[2] / length });
+    }
+
+    float axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    bounds.cone_cutoff = 1.0f;
+
+    if (axis_length > 0.0f) {
+        float min_dot = 1.0f;
+
+        for (size_t k = 0; k < 3; k++) bounds.cone_axis[k] = axis[k] / axis_length;
+        for (const auto& n : normals)
+            min_dot = std::min(min_dot, n[0] * bounds.cone_axis[0] + n[1] * bounds.cone_axis[1] + n[2] * bounds.cone_axis[2]);
+
+        // Sine of the cone spread, the cone is useless once it spans a half space
+        if (min_dot > 0.0f)
+            bounds.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+    }
+
+    return bounds;
+}
+
+} // namespace
+
+MeshletData BuildMeshlets(const IndexedArray<8>& mesh) {
+    const uint8_t unused = 0xff;
+    std::vector<uint8_t> local(mesh.out_vertices.size(), unused);
+
+    MeshletData data;
+    Meshlet current = {};
+
+    auto Flush = [&]() {
+        if (current.triangle_count == 0) return;
+
+        for (size_t i = 0; i < current.vertex_count; i++) local[data.vertices[current.vertex_offset + i]] = unused;
+
+        data.meshlets.push_back(current);
+        data.bounds.push_back(ComputeMeshletBounds(mesh, data, current));
+
+        current = {};
+        current.vertex_offset = (uint32_t)data.vertices.size();
+        current.triangle_offset = (uint32_t)data.triangles.size();
+    };
+
+    for (size_t t = 0; t + 2 < mesh.out_indices.size(); t += 3) {
+        const size_t* corners = &mesh.out_indices[t];
+
+        size_t new_vertices = (local[corners[0]] == unused)
+            + (local[corners[1]] == unused && corners[1] != corners[0])
+            + (local[corners[2]] == unused && corners[2] != corners[0] && corners[2] != corners[1]);
+
+        if (current.vertex_count + new_vertices > max_meshlet_vertices || current.triangle_count + 1 > max_meshlet_triangles)
+            Flush();
+
+        for (size_t corner = 0; corner < 3; corner++) {
+            size_t v = corners[corner];
+
+            if (local[v] == unused) {
+                local[v] = (uint8_t)current.vertex_count++;
+                data.vertices.push_back((uint32_t)v);
+            }
+
+            data.triangles.push_back(local[v]);
+        }
+
+        current.triangle_count++;
+    }
+
+    Flush();
+
+    return data;
+}
+
+void detail::WriteMeshlets(BlockWriter& writer, const MeshletData& data) {
+    const char magic[4] = { 'M', 'L', '8', '\0' };
+    writer.PutBytes(magic, sizeof(magic));
+    writer.Put<uint32_t>(1);
+    writer.Put<uint32_t>((uint32_t)max_meshlet_vertices);
+    writer.Put<uint32_t>((uint32_t)max_meshlet_triangles);
+
+    writer.Put<uint32_t>((uint32_t)data.meshlets.size());
+    writer.PutBytes(data.meshlets.data(), data.meshlets.size() * sizeof(Meshlet));
+    writer.PutBytes(data.bounds.data(), data.bounds.size() * sizeof(MeshletBounds));
+
+    writer.Put<uint32_t>((uint32_t)data.vertices.size());
+    writer.PutBytes(data.vertices.data(), data.vertices.size() * sizeof(uint32_t));
+
+    writer.Put<uint32_t>((uint32_t)data.triangles.size());
+    writer.PutBytes(data.triangles.data(), data.triangles.size());
+
+    const char padding[4] = {};
+    writer.PutBytes(padding, (4 - data.triangles.size() % 4) % 4);
+}
+
+void CreateMeshlets(fs::path path, const MeshletData& data) {
+    WriteBinaryFile(path, [&](BlockWriter& writer) {
+        WriteMeshlets(writer, data);
+    });
+}
+
+void CreateArchive(fs::path path, const std::vector<std::pair<std::string, fs::path>>& files, size_t alignment) {
+    std::vector<ArchiveEntry> entries(files.size());
+
+    size_t offset = 16 + files.size() * sizeof(ArchiveEntry);
+    for (size_t i = 0; i < files.size(); i++) {
+        entries[i].name_offset = (uint32_t)offset;
+        entries[i].name_size = (uint32_t)files[i].first.size();
+        offset += files[i].first.size();
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        entries[i].offset = offset;
+        entries[i].size = fs::file_size(files[i].second);
+        offset += entries[i].size;
+    }
+
+    WriteBinaryFile(path, [&](BlockWriter& writer) {
+        const char magic[4] = { 'T', 'P', 'K', '\0' };
+        writer.PutBytes(magic, sizeof(magic));
+        writer.Put<uint32_t>(1);
+        writer.Put<uint32_t>((uint32_t)alignment);
+
+        writer.Put<uint32_t>((uint32_t)entries.size());
+        writer.PutBytes(entries.data(), entries.size() * sizeof(ArchiveEntry));
+
+        offset = 16 + files.size() * sizeof(ArchiveEntry);
+        for (const auto& file : files) {
+            writer.PutBytes(file.first.data(), file.first.size());
+            offset += file.first.size();
+        }
+
+        const std::vector<char> padding(alignment);
+        for (size_t i = 0; i < files.size(); i++) {
+            writer.PutBytes(padding.data(), entries[i].offset - offset);
+
+            FileView section(files[i].second);
+            if (section.View().size() != entries[i].size) throw std::runtime_error("File changed while packing \""s + files[i].second.string() + "\""s);
+
+            writer.PutBytes(section.View().data(), section.View().size());
+            offset = entries[i].offset + entries[i].size;
+        }
+    });
+}
+
+Archive::Archive(const fs::path& path) : file(path) {
+    std::string_view data = file.View();
+
+    auto Check = [&](bool condition) {
+        if (!condition) throw std::runtime_error("Not an archive \"" + path.string() + "\"");
+    };
+
+    uint32_t header[4];
+    Check(data.size() >= sizeof(header));
+    std::memcpy(header, data.data(), sizeof(header));
+    Check(std::memcmp(header, "TPK", 4) == 0 && header[1] == 1);
+
+    size_t num_entries = header[3];
+    Check(num_entries <= (data.size() - sizeof(header)) / sizeof(ArchiveEntry));
+
+    for (size_t i = 0; i < num_entries; i++) {
+        ArchiveEntry entry;
+        std::memcpy(&entry, data.data() + sizeof(header) + i * sizeof(ArchiveEntry), sizeof(entry));
+
+        Check(entry.name_offset <= data.size() && entry.name_size <= data.size() - entry.name_offset);
+        Check(entry.offset <= data.size() && entry.size <= data.size() - entry.offset);
+
+        sections.emplace(data.substr(entry.name_offset, entry.name_size), data.substr((size_t)entry.offset, (size_t)entry.size));
+    }
+}
+
+fs::path ArchiveEntryPath(std::string_view name) {
+    fs::path path = fs::path(name).lexically_normal();
+
+    bool safe = !path.empty() && !path.has_root_name() && !path.has_root_directory() && !path.is_absolute()
+        && *path.begin() != ".." && path.has_filename() && path.filename() != ".";
+
+    if (!safe) throw std::runtime_error("Unsafe path \""s + std::string(name) + "\" in archive"s);
+    return path;
+}
+
+std::string LodName(const std::string& material_name, size_t level) {
+    return material_name + ".lod"s + std::to_string(level);
+}
+
+std::string MeshPartName(const std::string& material_name, size_t part) {
+    return part == 0 ? material_name : material_name + "."s + std::to_string(part);
+}
+
+void ParseMtl(std::string_view mtl, std::map<std::string, std::string>& material_textures) {
+    std::string current_material_name;
+
+    ParseLines(mtl, [&](std::string_view command, LineCursor& ls) {
+        if (command == "newmtl")
+            current_material_name = ls.Rest();
+        else if (command == "map_Kd")
+            material_textures[current_material_name] = ls.Rest();
+    });
+}
+
+ModelMaterials ConvertObj(std::string_view obj, const MtlLoader& load_mtl, const OutputSink& output, const ConvertOptions& options, Log& log, const fs::path& data_path, ConvertStats* stats, ConvertCache* cache) {
+    auto DumpPath = [&](const std::string& desc, const fs::path& path) {
+        log.Printf("%-20s \"%s\"\n", desc.c_str(), path.string().c_str());
+    };
+
+    // The cache gets this conversion once it is done, a failed one may have written files of
+    // meshes the cache does not hold
+    std::shared_ptr<ConvertCache::State> previous, next;
+
+    if (cache) {
+        previous = std::move(cache->state);
+        next = std::make_shared<ConvertCache::State>();
+
+        if (previous) next->chunks = std::move(previous->chunks);
+    }
+
+    // Split part and LOD names are made of the material name, a material named like the
+    // part or LOD of another one would silently replace its file
+    std::set<std::string> output_names;
+
+    // Every file of the conversion, written or kept
+    auto OutputName = [&](const std::string& file_name) {
+        if (!output_names.insert(file_name).second)
+            throw std::runtime_error("\""s + file_name + "\" is written twice, a material is named like a split part or LOD of another one"s);
+
+        if (next) next->files.push_back(file_name);
+    };
+
+    // Files of the last conversion made of a mesh that did not change
+    auto Keep = [&](const std::vector<std::string>& file_names) {
+        for (const auto& file_name : file_names)
+            OutputName(file_name);
+    };
+
+    // Writes a file of the data directory to the output, records count what it holds
+    auto Output = [&](const std::string& file_name, uint64_t records, auto write) {
+        OutputName(file_name);
+
+        PhaseTimer timer(stats, "Write ", file_name);
+        uint64_t bytes = 0;
+
+        output(file_name, [&](std::ostream& stream) {
+            BlockWriter writer(stream);
+            write(writer);
+            writer.Flush();
+
+            bytes = writer.Size();
+        });
+
+        timer.Count(bytes, records);
+    };
+
+    std::vector<Vec<3>> positions;
+    std::vector<Vec<2>> uvs;
+    std::vector<Vec<3>> normals;
+
+    ModelMaterials result;
+    auto& material_textures = result.material_textures;
+    std::map<std::string, Material> materials;
+    Material* current_material = nullptr;
+
+    CollisionMesh collision_mesh;
+
+    // Parse obj
+    PhaseTimer parse_timer(stats, "OBJ parse");
+    size_t num_parsed = 0;
+    auto chunks = ParseObjChunks(obj, options.threads, next ? &next->chunks : nullptr, &num_parsed);
+
+    if (next) log.Printf("%zu OBJ chunks, %zu kept from the last conversion\n", chunks.size(), chunks.size() - num_parsed);
+
+    size_t total_positions = 0, total_uvs = 0, total_normals = 0, total_faces = 0;
+    for (const auto& chunk : chunks) {
+        total_positions += chunk->positions.size();
+        total_uvs += chunk->uvs.size();
+        total_normals += chunk->normals.size();
+        total_faces += chunk->faces.size();
+    }
+
+    positions.reserve(total_positions);
+    uvs.reserve(total_uvs);
+    normals.reserve(total_normals);
+
+    for (const auto& chunk : chunks) {
+        positions.insert(positions.end(), chunk->positions.begin(), chunk->positions.end());
+        uvs.insert(uvs.end(), chunk->uvs.begin(), chunk->uvs.end());
+        normals.insert(normals.end(), chunk->normals.begin(), chunk->normals.end());
+    }
+
+    parse_timer.Count(obj.size(), total_positions + total_uvs + total_normals + total_faces);
+    parse_timer.Stop();
+
+    // Stitch chunks in file order, attributes of previous chunks offset the counts seen by each face
+    size_t position_offset = 0, uv_offset = 0, normal_offset = 0;
+
+    for (auto& chunk : chunks) {
+        // One face assembly timer per chunk, MTL loads in between are timed on their own.
+        // Corners are deduplicated as they are assembled
+        std::optional<PhaseTimer> assembly_timer;
+
+        for (const auto& command : chunk->commands) {
+            if (command.type == ObjChunk::Command::MtlLib) {
+                assembly_timer.reset();
+
+                PhaseTimer timer(stats, "MTL parse");
+                size_t num_materials = material_textures.size();
+
+                std::string mtl = load_mtl(command.name);
+                ParseMtl(mtl, material_textures);
+
+                timer.Count(mtl.size(), material_textures.size() - num_materials);
+            } else if (command.type == ObjChunk::Command::UseMtl) {
+                current_material = &materials[command.name];
+
+                log.Printf("Compiling material \"%s\"\n", command.name.c_str());
+            } else {
+                if (!current_material) throw std::runtime_error("F but no material");
+
+                if (!assembly_timer) assembly_timer.emplace(stats, "Face assembly");
+                assembly_timer->Count(0, command.face_end - command.face_begin);
+
+                size_t num_positions = position_offset + command.num_positions;
+                size_t num_uvs = uv_offset + command.num_uvs;
+                size_t num_normals = normal_offset + command.num_normals;
+
+                for (size_t face = command.face_begin; face < command.face_end; face++) {
+                    for (size_t i = 0; i < 3; i++) {
+                        const uint32_t* key = &chunk->faces[face][i * 3];
+
+                        if (key[0] == 0 || key[0] > num_positions) throw std::out_of_range("Position out of range");
+                        if (key[1] == 0 || key[1] > num_uvs) throw std::out_of_range("UV out of range");
+                        if (key[2] == 0 || key[2] > num_normals) throw std::out_of_range("Normal out of range");
+
+                        current_material->OutCorner(key, [&]() -> Vec<8> {
+                            auto& position = positions[key[0] - 1];
+                            auto& uv = uvs[key[1] - 1];
+                            auto& normal = normals[key[2] - 1];
+
+                            return { { position[0], position[1], position[2], uv[0], uv[1], normal[0], normal[1], normal[2] } };
+                        });
+                        collision_mesh.OutCorner(key[0], positions);
+                    }
+                }
+            }
+        }
+
+        position_offset += chunk->positions.size();
+        uv_offset += chunk->uvs.size();
+        normal_offset += chunk->normals.size();
+
+        chunk.reset();
+    }
+
+    if (stats) {
+        for (const auto& material : materials) {
+            stats->corners += material.second.mesh.out_indices.size();
+            stats->unique_vertices += material.second.mesh.out_vertices.size();
+        }
+    }
+
+    log.Printf("\nExporting...\n\n");
+
+    // Graphics export
+
+    IAFormat ia_format;
+    ia_format.index16 = options.index16;
+    ia_format.vertex_format = options.vertex_format;
+    ia_format.legacy_layout = options.legacy_ia;
+    ia_format.vertex_alignment = options.vertex_alignment;
+    ia_format.index_alignment = options.index_alignment;
+
+    auto& material_parts = result.material_parts;
+
+    // Exported meshes waiting for meshlet generation, kept ones only hold their place in the output
+    struct MeshletJob {
+        std::string file_name;
+        IndexedArray<8> mesh;
+        MeshletData meshlets;
+        bool kept = false;
+    };
+
+    std::vector<MeshletJob> meshlet_jobs;
+
+    // Shared buffer mode, every material is an index range of one IA8
+    IndexedArray<8> shared_mesh;
+    auto& material_ranges = result.material_ranges;
+
+    for (auto& material : materials) {
+        TraceScope trace("material", material.first);
+
+        fs::path material_ia8(data_path / fs::path(material.first + ".ia8"));
+
+        if (options.shared_buffer)
+            log.Printf("%-20s \"%s\"\n", "Material:", material.first.c_str());
+        else
+            DumpPath("Export: ", material_ia8);
+
+        auto& mesh = material.second.mesh;
+        size_t num_vertices = mesh.out_vertices.size();
+        size_t num_indices = mesh.out_indices.size();
+        log.Printf("%zu vertices, %zu indices (each vertex used %.1f times in avg)\n", num_vertices, num_indices, (float)num_indices / (float)num_vertices);
+
+        // Cache entry of the material, moved from the last conversion when the material assembled
+        // into the same mesh
+        ConvertCache::State::Material* cached = nullptr;
+        bool unchanged = false;
+
+        if (next) {
+            cached = &next->materials[material.first];
+
+            if (previous) {
+                auto last = previous->materials.find(material.first);
+                unchanged = last != previous->materials.end()
+                    && last->second.mesh.out_vertices == mesh.out_vertices && last->second.mesh.out_indices == mesh.out_indices;
+
+                if (unchanged) *cached = std::move(last->second);
+            }
+
+            if (!unchanged) {
+                cached->mesh.out_vertices = mesh.out_vertices;
+                cached->mesh.out_indices = mesh.out_indices;
+            }
+        }
+
+        // The shared buffer is made of every material, only the LODs of an unchanged one are kept
+        if (unchanged && !options.shared_buffer) {
+            log.Printf("Unchanged, files kept\n\n");
+
+            material_parts[material.first] = cached->parts;
+            Keep(cached->files);
+
+            for (const auto& file_name : cached->meshlet_files)
+                meshlet_jobs.push_back({ file_name, IndexedArray<8>(), MeshletData(), true });
+
+            continue;
+        }
+
+        std::vector<std::string> material_files;
+
+        if (options.optimize_vertex_cache) {
+            PhaseTimer timer(stats, "Vertex cache");
+            timer.Count(0, num_indices);
+
+            auto before = AnalyzeVertexCache(mesh.out_indices, num_vertices);
+            OptimizeVertexCache(mesh.out_indices, num_vertices);
+            auto after = AnalyzeVertexCache(mesh.out_indices, num_vertices);
+
+            log.Printf("Vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", before.acmr, after.acmr, before.atvr, after.atvr);
+        }
+
+        // LOD chain, each level continues from the previous one
+        if (!options.lod_ratios.empty() && unchanged) {
+            log.Printf("LODs unchanged, files kept\n");
+            Keep(cached->files);
+        } else if (!options.lod_ratios.empty()) {
+            PhaseTimer setup_timer(stats, "LOD simplify");
+            Simplifier<8> simplifier(mesh);
+            setup_timer.Stop();
+            size_t num_triangles = num_indices / 3;
+
+            for (size_t level = 1; level <= options.lod_ratios.size(); level++) {
+                PhaseTimer timer(stats, "LOD simplify");
+                timer.Count(0, simplifier.NumTriangles());
+
+                simplifier.Simplify((size_t)(options.lod_ratios[level - 1] * num_triangles));
+
+                IndexedArray<8> lod;
+                lod.out_vertices = mesh.out_vertices;
+                lod.out_indices = simplifier.Indices();
+
+                if (options.optimize_vertex_cache)
+                    OptimizeVertexCache(lod.out_indices, lod.out_vertices.size());
+
+                lod.OptimizeVertexFetch();
+                timer.Stop();
+
+                std::string lod_ia8 = LodName(material.first, level) + ".ia8"s;
+                DumpPath("LOD: ", data_path / fs::path(lod_ia8));
+                log.Printf("%zu triangles, distance error %g max, %g mean\n", simplifier.NumTriangles(), simplifier.MaxError(), simplifier.MeanError());
+
+                // LODs are not split, they stay one mesh with 32-bit indices
+                if (options.split_index16 && lod.out_vertices.size() > max_index16_vertices)
+                    log.Printf("Warning: %zu vertices, too many for 16-bit indices, not split\n", lod.out_vertices.size());
+
+                Output(lod_ia8, lod.out_vertices.size() + lod.out_indices.size(), [&](BlockWriter& writer) { WriteIA<8>(writer, lod, ia_format); });
+                material_files.push_back(lod_ia8);
+            }
+        }
+
+        // Vertices shared with earlier materials are stored once
+        if (options.shared_buffer) {
+            std::vector<size_t> remap(mesh.out_vertices.size());
+            for (size_t v = 0; v < mesh.out_vertices.size(); v++)
+                remap[v] = shared_mesh.AddVertex(mesh.out_vertices[v]);
+
+            material_parts[material.first] = 1;
+            material_ranges[material.first] = { shared_mesh.out_indices.size(), num_indices };
+
+            for (const auto index : mesh.out_indices)
+                shared_mesh.out_indices.push_back(remap[index]);
+
+            if (cached && !unchanged) cached->files = material_files;
+
+            log.Printf("\n");
+            continue;
+        }
+
+        std::vector<IndexedArray<8>> parts;
+
+        if (options.split_index16 && num_vertices > max_index16_vertices) {
+            parts = SplitIndexedArray(mesh, max_index16_vertices);
+            log.Printf("Split into %zu meshes for 16-bit indices\n", parts.size());
+        } else {
+            parts.push_back(std::move(mesh));
+        }
+
+        material_parts[material.first] = parts.size();
+
+        for (size_t part = 0; part < parts.size(); part++) {
+            std::string part_ia8 = MeshPartName(material.first, part) + ".ia8"s;
+            if (part > 0) DumpPath("Export: ", data_path / fs::path(part_ia8));
+
+            if (options.optimize_vertex_fetch) {
+                PhaseTimer timer(stats, "Vertex fetch");
+                timer.Count(0, parts[part].out_vertices.size());
+
+                parts[part].OptimizeVertexFetch();
+            }
+
+            Output(part_ia8, parts[part].out_vertices.size() + parts[part].out_indices.size(), [&](BlockWriter& writer) { WriteIA<8>(writer, parts[part], ia_format); });
+            material_files.push_back(part_ia8);
+
+            if (options.build_meshlets)
+                meshlet_jobs.push_back({ MeshPartName(material.first, part) + ".meshlets"s, std::move(parts[part]), MeshletData() });
+        }
+
+        if (cached) {
+            cached->parts = parts.size();
+            cached->files = material_files;
+
+            if (options.build_meshlets)
+                for (size_t part = 0; part < parts.size(); part++)
+                    cached->meshlet_files.push_back(MeshPartName(material.first, part) + ".meshlets"s);
+        }
+
+        log.Printf("\n");
+    }
+
+    if (options.shared_buffer) {
+        DumpPath("Export: ", data_path / fs::path("shared.ia8"));
+
+        if (options.optimize_vertex_fetch) {
+            PhaseTimer timer(stats, "Vertex fetch");
+            timer.Count(0, shared_mesh.out_vertices.size());
+
+            shared_mesh.OptimizeVertexFetch();
+        }
+
+        size_t num_vertices = shared_mesh.out_vertices.size();
+        size_t num_indices = shared_mesh.out_indices.size();
+        log.Printf("%zu vertices, %zu indices (each vertex used %.1f times in avg)\n\n", num_vertices, num_indices, (float)num_indices / (float)num_vertices);
+
+        Output("shared.ia8"s, num_vertices + num_indices, [&](BlockWriter& writer) { WriteIA<8>(writer, shared_mesh, ia_format); });
+    }
+
+    // Meshlets of all exported meshes in parallel
+    if (!meshlet_jobs.empty()) {
+        PhaseTimer timer(stats, "Meshlet build");
+        for (const auto& job : meshlet_jobs)
+            timer.Count(0, job.mesh.out_indices.size() / 3);
+
+        ParallelFor(meshlet_jobs.size(), options.threads, [&](size_t i) {
+            if (meshlet_jobs[i].kept) return;
+
+            TraceScope trace("meshlets", meshlet_jobs[i].file_name);
+            meshlet_jobs[i].meshlets = BuildMeshlets(meshlet_jobs[i].mesh);
+        });
+    }
+
+    for (const auto& job : meshlet_jobs) {
+        if (job.kept) {
+            Keep({ job.file_name });
+            continue;
+        }
+
+        DumpPath("Meshlets: ", data_path / fs::path(job.file_name));
+
+        size_t num_meshlets = job.meshlets.meshlets.size();
+        log.Printf("%zu meshlets (%.1f triangles, %.1f vertices per meshlet in avg)\n\n", num_meshlets,
+            num_meshlets ? (float)(job.mesh.out_indices.size() / 3) / (float)num_meshlets : 0.0f,
+            num_meshlets ? (float)job.meshlets.vertices.size() / (float)num_meshlets : 0.0f);
+
+        Output(job.file_name, num_meshlets, [&](BlockWriter& writer) { WriteMeshlets(writer, job.meshlets); });
+    }
+
+    // Physics export
+
+    DumpPath("Collision: ", data_path / fs::path("collision.ia3"));
+
+    if (next) {
+        bool unchanged = previous && previous->collision_mesh.out_vertices == collision_mesh.mesh.out_vertices
+            && previous->collision_mesh.out_indices == collision_mesh.mesh.out_indices;
+
+        if (unchanged) {
+            next->collision_mesh = std::move(previous->collision_mesh);
+            next->collision_files = std::move(previous->collision_files);
+
+            log.Printf("Unchanged, files kept\n\n");
+            Keep(next->collision_files);
+
+            cache->state = std::move(next);
+            return result;
+        }
+
+        next->collision_mesh.out_vertices = collision_mesh.mesh.out_vertices;
+        next->collision_mesh.out_indices = collision_mesh.mesh.out_indices;
+        next->collision_files.push_back("collision.ia3"s);
+        if (options.build_bvh) next->collision_files.push_back("collision.bvh"s);
+    }
+
+    // Collision simplification, independent of the render LODs
+    if (options.collision_triangles > 0 || options.collision_error > 0.0) {
+        auto& mesh = collision_mesh.mesh;
+        size_t num_triangles = mesh.out_indices.size() / 3;
+
+        PhaseTimer timer(stats, "Collision simplify");
+        timer.Count(0, num_triangles);
+
+        Simplifier<3> simplifier(mesh);
+        simplifier.Simplify(options.collision_triangles,
+            options.collision_error > 0.0 ? options.collision_error : std::numeric_limits<double>::infinity());
+
+        mesh.out_indices = simplifier.Indices();
+        mesh.OptimizeVertexFetch();
+        timer.Stop();
+
+        log.Printf("Simplified from %zu to %zu triangles, distance error %g max, %g mean\n", num_triangles, simplifier.NumTriangles(), simplifier.MaxError(), simplifier.MeanError());
+    } else if (options.optimize_vertex_fetch) {
+        PhaseTimer timer(stats, "Vertex fetch");
+        timer.Count(0, collision_mesh.mesh.out_vertices.size());
+
+        collision_mesh.mesh.OptimizeVertexFetch();
+    }
+
+    // BVH build, collision.ia3 is written in the same triangle order
+    BVH bvh;
+
+    if (options.build_bvh) {
+        PhaseTimer timer(stats, "BVH build");
+        timer.Count(0, collision_mesh.mesh.out_indices.size() / 3);
+
+        bvh = BuildBVH(collision_mesh.mesh);
+        collision_mesh.mesh = bvh.mesh;
+    }
+
+    size_t num_vertices = collision_mesh.mesh.out_vertices.size();
+    size_t num_indices = collision_mesh.mesh.out_indices.size();
+    log.Printf("%zu vertices, %zu indices (each vertex used %.1f times in avg)\n\n", num_vertices, num_indices, (float)num_indices / (float)num_vertices);
+
+    Output("collision.ia3"s, num_vertices + num_indices, [&](BlockWriter& writer) { WriteIA<3>(writer, collision_mesh.mesh, ia_format); });
+
+    if (options.build_bvh) {
+        DumpPath("Collision BVH: ", data_path / fs::path("collision.bvh"));
+
+        size_t num_leaves = 0;
+        for (const auto& node : bvh.nodes)
+            if (node.count > 0) num_leaves++;
+
+        log.Printf("%zu nodes, %zu leaves (%.1f triangles per leaf in avg)\n\n", bvh.nodes.size(), num_leaves, num_leaves ? (float)(num_indices / 3) / (float)num_leaves : 0.0f);
+
+        Output("collision.bvh"s, bvh.nodes.size(), [&](BlockWriter& writer) { WriteBVH(writer, bvh); });
+    }
+
+    if (cache) cache->state = std::move(next);
+
+    return result;
+}
+
+void UpdateTMDL(nlohmann::json& tmdl, const std::string& model_name, const ModelMaterials& materials, const ConvertOptions& options) {
+    auto& tmdl_draw = tmdl["draw"];
+    for (const auto& material : materials.material_textures) {
+        auto parts = materials.material_parts.find(material.first);
+        size_t num_parts = parts != materials.material_parts.end() ? parts->second : 1;
+
+        for (size_t part = 0; part < num_parts; part++) {
+            std::string mesh_name = MeshPartName(material.first, part);
+
+            auto& tmdl_material = tmdl_draw[mesh_name];
+            tmdl_material["texture"] = std::regex_replace(material.second, std::regex("\\\\\\\\"), "/");
+
+            if (options.shared_buffer) {
+                auto range = materials.material_ranges.find(material.first);
+
+                tmdl_material["mesh"] = model_name + "/shared.ia8"s;
+                tmdl_material["first_index"] = range != materials.material_ranges.end() ? range->second.first : 0;
+                tmdl_material["index_count"] = range != materials.material_ranges.end() ? range->second.second : 0;
+            } else {
+                tmdl_material["mesh"] = model_name + "/"s + mesh_name + ".ia8"s;
+                tmdl_material.erase("first_index");
+                tmdl_material.erase("index_count");
+            }
+
+            // LODs cover the whole material and are listed on its first part
+            if (part == 0 && !options.lod_ratios.empty() && materials.material_parts.count(material.first)) {
+                auto& tmdl_lods = tmdl_material["lods"];
+                tmdl_lods = nlohmann::json::array();
+
+                for (size_t level = 1; level <= options.lod_ratios.size(); level++)
+                    tmdl_lods.push_back(model_name + "/"s + LodName(material.first, level) + ".ia8"s);
+            } else {
+                tmdl_material.erase("lods");
+            }
+        }
+
+        // Parts of an earlier conversion that split the material further
+        for (size_t part = num_parts; ; part++) {
+            std::string mesh_name = MeshPartName(material.first, part);
+            if (!tmdl_draw.contains(mesh_name) || materials.material_textures.count(mesh_name)) break;
+
+            tmdl_draw.erase(mesh_name);
+        }
+    }
+
+    if (!tmdl.contains("name"))
+        tmdl["name"] = model_name;
+
+    if (!tmdl.contains("collision"))
+        tmdl["collision"] = model_name + "/collision.ia3"s;
+
+    if (options.build_bvh)
+        tmdl["collision_bvh"] = model_name + "/collision.bvh"s;
+    else
+        tmdl.erase("collision_bvh");
+
+    if (!tmdl.contains("mass"))
+        tmdl["mass"] = 0.0f;
+}
+
+ConvertedModel ConvertObjToMemory(std::string_view obj, const MtlLoader& load_mtl, const std::string& model_name, const ConvertOptions& options, Log& log, ConvertStats* stats) {
+    ConvertedModel model;
+
+    model.materials = ConvertObj(obj, load_mtl, [&](const std::string& file_name, const OutputWriter& write) {
+        std::ostringstream stream(std::ios::binary);
+        write(stream);
+
+        model.files[file_name] = stream.str();
+    }, options, log, fs::path(model_name), stats);
+
+    PhaseTimer timer(stats, "TMDL update");
+    UpdateTMDL(model.tmdl, model_name, model.materials, options);
+
+    return model;
+}
+
+} // namespace obj2tsr3
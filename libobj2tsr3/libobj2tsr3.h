@@ -0,0 +1,743 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace obj2tsr3 {
+
+// Vector type
+template<size_t size>
+class Vec {
+    float value[size];
+public:
+    Vec() {}
+
+    Vec(const std::array<float, size>& i_value) {
+        for (size_t i = 0; i < size; i++)
+            value[i] = i_value[i];
+    }
+
+    float& operator[](const size_t i) {
+        return value[i];
+    }
+
+    const float& operator[](const size_t i) const {
+        return value[i];
+    }
+
+    bool operator==(const Vec<size>& rhs) const {
+        for (size_t i = 0; i < size; i++)
+            if (value[i] != rhs[i]) return false;
+
+        return true;
+    }
+
+    // Hash of the bit pattern, consistent with operator== (+0.0 and -0.0 hash equal)
+    size_t Hash() const {
+        uint64_t hash = 14695981039346656037ull;
+
+        for (size_t i = 0; i < size; i++) {
+            float component = value[i] == 0.0f ? 0.0f : value[i];
+            uint32_t bits;
+            std::memcpy(&bits, &component, sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ull;
+        }
+
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+
+        return (size_t)hash;
+    }
+};
+
+// IA8 / IA3 generator
+template<size_t size>
+struct IndexedArray {
+    std::vector<Vec<size>> out_vertices;
+    std::vector<size_t> out_indices;
+
+    // Open addressing index over out_vertices, slot holds vertex index + 1 (0 is empty)
+    std::vector<uint32_t> vertex_table;
+
+    void OutVertex(const Vec<size>& value) {
+        out_indices.push_back(AddVertex(value));
+    }
+
+    // Index of value in out_vertices, appended if not there yet
+    size_t AddVertex(const Vec<size>& value) {
+        // Keep load factor at most 1/2
+        if ((out_vertices.size() + 1) * 2 > vertex_table.size())
+            RebuildTable(std::max<size_t>(64, vertex_table.size() * 2));
+
+        size_t mask = vertex_table.size() - 1;
+
+        for (size_t slot = value.Hash() & mask; ; slot = (slot + 1) & mask) {
+            uint32_t entry = vertex_table[slot];
+
+            if (entry == 0) {
+                out_vertices.push_back(value);
+                vertex_table[slot] = (uint32_t)out_vertices.size();
+                return out_vertices.size() - 1;
+            }
+
+            if (out_vertices[entry - 1] == value)
+                return entry - 1;
+        }
+    }
+
+    // Renumber vertices in order of first use in out_indices, unused vertices are dropped.
+    // Indices handed out earlier (corner and position remaps) no longer apply afterwards
+    void OptimizeVertexFetch() {
+        const size_t unused = std::numeric_limits<size_t>::max();
+        std::vector<size_t> remap(out_vertices.size(), unused);
+        std::vector<Vec<size>> vertices;
+        vertices.reserve(out_vertices.size());
+
+        for (auto& index : out_indices) {
+            if (remap[index] == unused) {
+                remap[index] = vertices.size();
+                vertices.push_back(out_vertices[index]);
+            }
+
+            index = remap[index];
+        }
+
+        out_vertices.swap(vertices);
+
+        if (!vertex_table.empty())
+            RebuildTable(vertex_table.size());
+    }
+
+    // Rebuild the index from out_vertices (table_size must be a power of two)
+    void RebuildTable(size_t table_size) {
+        vertex_table.assign(table_size, 0);
+        size_t mask = table_size - 1;
+
+        for (size_t i = 0; i < out_vertices.size(); i++) {
+            size_t slot = out_vertices[i].Hash() & mask;
+            while (vertex_table[slot] != 0) slot = (slot + 1) & mask;
+            vertex_table[slot] = (uint32_t)(i + 1);
+        }
+    }
+};
+
+// 64-bit content hash for change detection, 8 bytes per step, not cryptographic
+uint64_t HashBytes(std::string_view data);
+
+// Read-only view of a whole file, memory mapped when possible
+class FileView {
+    const char* data = nullptr;
+    size_t size = 0;
+    std::string buffer; // Fallback for pipes and other files that cannot be mapped
+    void* file = nullptr;    // File handle on Windows
+    void* mapping = nullptr; // File mapping handle on Windows, mapped address elsewhere
+
+public:
+    explicit FileView(const std::filesystem::path& file_path);
+    ~FileView();
+
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    std::string_view View() const {
+        return std::string_view(data, size);
+    }
+
+private:
+    bool Map(const std::filesystem::path& file_path);
+    void Read(const std::filesystem::path& file_path);
+};
+
+// Cursor over a single OBJ / MTL line
+class LineCursor {
+    const char* pos;
+    const char* end;
+
+public:
+    explicit LineCursor(std::string_view line) : pos(line.data()), end(line.data() + line.size()) {}
+
+    void SkipSpace() {
+        while (pos != end && (*pos == ' ' || *pos == '\t')) pos++;
+    }
+
+    // Next whitespace separated token
+    std::string_view Word() {
+        SkipSpace();
+        const char* begin = pos;
+        while (pos != end && *pos != ' ' && *pos != '\t') pos++;
+        return std::string_view(begin, pos - begin);
+    }
+
+    // Remainder of the line
+    std::string_view Rest() {
+        std::string_view rest(pos, end - pos);
+        pos = end;
+        return rest;
+    }
+
+    // Next non-space character, '\0' at the end of the line
+    char Char() {
+        SkipSpace();
+        return pos != end ? *pos++ : '\0';
+    }
+
+    // Unsigned decimal, 0 when there is none
+    size_t Index() {
+        SkipSpace();
+        size_t value = 0;
+        for (; pos != end && *pos >= '0' && *pos <= '9'; pos++)
+            value = value * 10 + (size_t)(*pos - '0');
+        return value;
+    }
+
+    // Float, 0.0 when there is none
+    float Float() {
+        SkipSpace();
+
+        const char* begin = pos;
+        if (begin != end && *begin == '+') begin++;
+
+        float value;
+        auto result = std::from_chars(begin, end, value);
+
+        if (result.ec == std::errc() && std::isfinite(value) && (result.ptr == end || *result.ptr == ' ' || *result.ptr == '\t')) {
+            pos = result.ptr;
+            return value;
+        }
+
+        return SlowFloat();
+    }
+
+private:
+    // Token read as istream >> float reads it, for anything from_chars rejects or reads as
+    // inf / nan. Only leading digits, signs, '.' and exponents are read, so inf, nan and hex
+    // floats are 0, and out of range values are clamped to +-FLT_MAX
+    float SlowFloat() {
+        std::string_view token = Word();
+
+        size_t length = 0;
+        while (length < token.size() && ((token[length] >= '0' && token[length] <= '9') || token[length] == '+'
+            || token[length] == '-' || token[length] == '.' || token[length] == 'e' || token[length] == 'E'))
+            length++;
+
+        char text[64];
+        if (length == 0 || length >= sizeof(text)) return 0.0f;
+
+        std::memcpy(text, token.data(), length);
+        text[length] = '\0';
+
+        float value = std::strtof(text, nullptr);
+        if (std::isinf(value)) return std::copysign(std::numeric_limits<float>::max(), value);
+
+        return value;
+    }
+};
+
+// OBJ / MTL line splitter
+template<typename Callback>
+void ParseLines(std::string_view text, Callback callback) {
+    for (size_t begin = 0; begin < text.size(); ) {
+        size_t end = text.find('\n', begin);
+        if (end == std::string_view::npos) end = text.size();
+
+        std::string_view line = text.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty() || line[0] == '#') continue;
+
+        LineCursor ls(line);
+
+        std::string_view command = ls.Word();
+        ls.SkipSpace();
+
+        callback(command, ls);
+    }
+}
+
+// OBJ / MTL parser
+template<typename Callback>
+void ParseFile(std::filesystem::path file_path, Callback callback) {
+    FileView file(file_path);
+    ParseLines(file.View(), callback);
+}
+
+// Runs task(i) for every i in [0, count) on up to threads threads (0 uses every hardware thread).
+// The first exception thrown by a task is rethrown once all threads are done
+template<typename Task>
+void ParallelFor(size_t count, unsigned threads, Task task) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t num_workers = std::min<size_t>(threads, count);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(count);
+
+    auto Work = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                task(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < num_workers; i++)
+        workers.emplace_back(Work);
+
+    Work();
+
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : errors)
+        if (error) std::rethrow_exception(error);
+}
+
+// IA8 vertex layouts
+enum class VertexFormat : uint8_t {
+    Float = 0, // 32 bytes: float position, uv, normal
+    Q16 = 1,   // 16 bytes: unorm16 position (+ 2 bytes padding), half uv, snorm16 octahedral normal
+    Q12 = 2,   // 12 bytes: unorm16 position, unorm16 uv, snorm8 octahedral normal
+};
+
+// IA format extensions
+struct IAFormat {
+    bool index16 = false; // uint16_t indices when every vertex fits
+    VertexFormat vertex_format = VertexFormat::Float; // IA8 only, IA3 stays float
+    bool legacy_layout = false; // Unaligned revision 0 to 2 layout, revision 0 when no other extension is used
+    size_t vertex_alignment = 64; // Vertices block alignment from the start of the file (revision 3)
+    size_t index_alignment = 64;  // Indices block alignment from the start of the file (revision 3)
+};
+
+// Writes an IA file
+//   char[4]      "IA", '8' or '3', '\0'
+//   uint8_t      Revision, 0 in legacy files
+//   uint8_t      Index size in bytes (revision 1+, legacy files use 4)
+//   uint8_t      VertexFormat (revision 2+, legacy files use Float)
+//   uint8_t      Reserved
+//   uint32_t     Size of the extension block after the header (revision 2+)
+//   uint8_t[4]   Reserved
+// Revision 3, blocks at aligned offsets so a mapped file can be uploaded in place
+//   uint32_t     Vertex count
+//   uint32_t     Vertices block offset
+//   uint32_t     Index count
+//   uint32_t     Indices block offset
+//   ...          Extension block, QuantizationBlock for quantized vertex formats
+//   ...          Zero padding, vertices block, zero padding, indices block
+// Revisions 0 to 2
+//   ...          Extension block, QuantizationBlock for quantized vertex formats
+//   uint32_t     Vertex count, followed by the vertices
+//   uint32_t     Index count, followed by the indices
+template<size_t size>
+void CreateIA(std::filesystem::path path, const IndexedArray<size>& data, const IAFormat& format = {});
+
+// Collision BVH node, 32 bytes. Nodes are in depth first order, the left child follows its parent
+struct BVHNode {
+    float min[3];
+    uint32_t offset; // Leaf: first triangle, inner node: index of the right child
+    float max[3];
+    uint32_t count;  // Leaf: triangle count, never 0. Inner node: 0
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must be 32 bytes");
+
+// Collision mesh with its triangles in BVH leaf order
+struct BVH {
+    std::vector<BVHNode> nodes;
+    IndexedArray<3> mesh;
+};
+
+// Binned SAH build (16 bins per axis) over the triangles of mesh
+BVH BuildBVH(const IndexedArray<3>& mesh, size_t max_leaf_triangles = 4);
+
+// BVH file layout
+//   char[4]      "BV3", '\0'
+//   uint32_t     Revision, 1
+//   uint32_t     Node count, followed by the BVHNodes, 0 for an empty collision mesh
+//   uint32_t     Vertex count, followed by the vertices as 3 floats
+//   uint32_t     Index count, followed by uint32_t indices, triangles in leaf order
+void CreateBVH(std::filesystem::path path, const BVH& bvh);
+
+// Reference loader for BVH files
+BVH LoadBVH(std::filesystem::path path);
+
+// Closest ray hit distance along direction (Moller-Trumbore), max_distance when nothing is hit
+float RayQuery(const BVH& bvh, const float origin[3], const float direction[3], float max_distance);
+
+// Triangles whose bounds overlap the box, returns their count
+size_t AabbQuery(const BVH& bvh, const float min[3], const float max[3], std::vector<uint32_t>& triangles);
+
+// Meshlet of an IA8 mesh, ranges into MeshletData::vertices and MeshletData::triangles
+struct Meshlet {
+    uint32_t vertex_offset;
+    uint32_t triangle_offset; // In bytes, 3 local vertex indices per triangle
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+};
+
+// Culling data of a meshlet. The meshlet faces away from a camera at position c when
+// dot(center - c, cone_axis) >= cone_cutoff * length(center - c) + radius
+struct MeshletBounds {
+    float center[3];
+    float radius;
+    float cone_axis[3];
+    float cone_cutoff; // 1 when the triangles face too many directions to cull
+};
+
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshletBounds> bounds;
+    std::vector<uint32_t> vertices; // Indices into the IA8 vertices block
+    std::vector<uint8_t> triangles;
+};
+
+constexpr size_t max_meshlet_vertices = 64;
+constexpr size_t max_meshlet_triangles = 124;
+
+// Greedy meshlets in index order, run after OptimizeVertexCache for compact meshlets
+MeshletData BuildMeshlets(const IndexedArray<8>& mesh);
+
+// Meshlet file layout
+//   char[4]      "ML8", '\0'
+//   uint32_t     Revision, 1
+//   uint32_t     Max vertices per meshlet
+//   uint32_t     Max triangles per meshlet
+//   uint32_t     Meshlet count, followed by the Meshlets, then by the MeshletBounds
+//   uint32_t     Vertex count, followed by uint32_t indices into the IA8 vertices block
+//   uint32_t     Triangle byte count, followed by uint8_t local indices, padded to 4 bytes
+void CreateMeshlets(std::filesystem::path path, const MeshletData& data);
+
+// Archive file layout
+//   char[4]      "TPK", '\0'
+//   uint32_t     Revision, 1
+//   uint32_t     Section alignment in bytes
+//   uint32_t     Entry count, followed by the ArchiveEntries
+//   ...          Entry names, UTF-8 without terminator
+//   ...          Sections, each at a multiple of the alignment from the start of the file, zero padded
+// Entry names are the paths the TMDL refers to, the TMDL itself is stored as "<model>.tmdl"
+struct ArchiveEntry {
+    uint64_t offset;      // Section offset from the start of the file
+    uint64_t size;        // Section size in bytes
+    uint32_t name_offset; // Name offset from the start of the file
+    uint32_t name_size;
+};
+
+constexpr size_t archive_alignment = 64;
+
+// Packs files into one archive, entries are (name, file path) pairs
+void CreateArchive(std::filesystem::path path, const std::vector<std::pair<std::string, std::filesystem::path>>& files, size_t alignment = archive_alignment);
+
+// Reference reader for archives, sections are views into the mapped file
+class Archive {
+    FileView file;
+    std::map<std::string, std::string_view, std::less<>> sections;
+
+public:
+    explicit Archive(const std::filesystem::path& path);
+
+    const std::map<std::string, std::string_view, std::less<>>& Sections() const {
+        return sections;
+    }
+
+    std::string_view Section(std::string_view name) const {
+        auto section = sections.find(name);
+        if (section == sections.end()) throw std::out_of_range("No section \"" + std::string(name) + "\" in archive");
+
+        return section->second;
+    }
+};
+
+// Path to extract an archive entry to, relative to the extraction directory. Throws on names that
+// would leave it: absolute, rooted, drive relative or climbing out with ".."
+std::filesystem::path ArchiveEntryPath(std::string_view name);
+
+// File name (without extension) of a material LOD, level 1 is the first simplified one
+std::string LodName(const std::string& material_name, size_t level);
+
+// File name (without extension) of a part of a split material, the first part keeps the material name
+std::string MeshPartName(const std::string& material_name, size_t part);
+
+// Conversion log, printed as it goes or buffered so that the logs of concurrent conversions do not interleave
+class Log {
+    bool buffered;
+    std::string text;
+
+public:
+    explicit Log(bool buffered = false) : buffered(buffered) {}
+
+    void Printf(const char* format, ...) {
+        va_list args;
+
+        if (!buffered) {
+            va_start(args, format);
+            vprintf(format, args);
+            va_end(args);
+            return;
+        }
+
+        va_start(args, format);
+        int length = vsnprintf(nullptr, 0, format, args);
+        va_end(args);
+
+        if (length <= 0) return;
+
+        size_t used = text.size();
+        text.resize(used + (size_t)length + 1);
+
+        va_start(args, format);
+        vsnprintf(&text[used], (size_t)length + 1, format, args);
+        va_end(args);
+
+        text.resize(used + (size_t)length);
+    }
+
+    const std::string& Text() const {
+        return text;
+    }
+};
+
+// Chrome trace event recording, the JSON opens in Perfetto or chrome://tracing. Events are
+// recorded from Start on, before that a scope costs a single flag test
+class Trace {
+    static std::atomic<bool> enabled;
+
+public:
+    static bool Enabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static void Start();
+
+    // Complete event on the lane of the calling thread, args are shown with the event
+    static void Record(const char* category, const std::string& name, std::chrono::steady_clock::time_point begin,
+        std::chrono::steady_clock::time_point end, nlohmann::json args = {});
+
+    // Writes the events recorded since the last Save and drops them, recording goes on. Saving to
+    // the path of the last Save appends to its file, so that a long session keeps a bounded buffer
+    static void Save(const std::filesystem::path& path);
+};
+
+// Records a trace event from construction to destruction when tracing, the name is only copied
+// when tracing
+class TraceScope {
+    const char* category = nullptr;
+    std::string name;
+    std::chrono::steady_clock::time_point begin;
+
+public:
+    TraceScope(const char* category, std::string_view name) {
+        if (!Trace::Enabled()) return;
+
+        this->category = category;
+        this->name = name;
+        begin = std::chrono::steady_clock::now();
+    }
+
+    // Only for paths, strings convert to both
+    template<class Path, class = std::enable_if_t<std::is_same_v<Path, std::filesystem::path>>>
+    TraceScope(const char* category, const Path& path) {
+        if (!Trace::Enabled()) return;
+
+        this->category = category;
+        name = path.string();
+        begin = std::chrono::steady_clock::now();
+    }
+
+    ~TraceScope() {
+        if (category) Trace::Record(category, name, begin, std::chrono::steady_clock::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// Wall time and counters of a conversion phase, summed over every time it ran.
+// Bytes and records are what the phase read or wrote, such as OBJ text and its
+// v / vt / vn / f lines, or an IA file and its vertices and indices
+struct PhaseStats {
+    std::string name;
+    double seconds = 0.0;
+    uint64_t bytes = 0;
+    uint64_t records = 0;
+};
+
+// Per-phase timing and counters of a model conversion
+struct ConvertStats {
+    std::vector<PhaseStats> phases; // In order of first run
+    double seconds = 0.0;           // Wall time of the whole conversion
+    uint64_t corners = 0;           // Face corners of the render meshes
+    uint64_t unique_vertices = 0;   // Render vertices left after corner deduplication
+    size_t peak_memory = 0;         // Peak resident memory of the process in bytes, 0 when unknown
+
+    PhaseStats& Phase(const std::string& name);
+
+    // Share of the face corners that reused a vertex
+    double DedupHitRate() const {
+        return corners ? 1.0 - (double)unique_vertices / (double)corners : 0.0;
+    }
+
+    void Print(Log& log) const;
+    nlohmann::json Json() const;
+};
+
+// Times a phase from construction to destruction or Stop into stats and the trace,
+// does nothing without stats when not tracing. The name is the prefix followed by the
+// name, it is only built when timing
+class PhaseTimer {
+    ConvertStats* stats;
+    bool trace;
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+    uint64_t bytes = 0;
+    uint64_t records = 0;
+
+public:
+    PhaseTimer(ConvertStats* stats, std::string_view name) : PhaseTimer(stats, {}, name) {
+    }
+
+    PhaseTimer(ConvertStats* stats, std::string_view prefix, std::string_view name) : stats(stats), trace(Trace::Enabled()) {
+        if (!stats && !trace) return;
+
+        this->name.reserve(prefix.size() + name.size());
+        this->name.append(prefix).append(name);
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer() {
+        Stop();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    void Count(uint64_t phase_bytes, uint64_t phase_records) {
+        bytes += phase_bytes;
+        records += phase_records;
+    }
+
+    // Ends the phase before the end of the scope
+    void Stop() {
+        if (!stats && !trace) return;
+
+        auto end = std::chrono::steady_clock::now();
+
+        if (stats) {
+            auto& phase = stats->Phase(name);
+            phase.seconds += std::chrono::duration<double>(end - start).count();
+            phase.bytes += bytes;
+            phase.records += records;
+        }
+
+        if (trace)
+            Trace::Record("phase", name, start, end, { { "bytes", bytes }, { "records", records } });
+
+        stats = nullptr;
+        trace = false;
+    }
+};
+
+// Peak resident memory (working set) of the process in bytes, 0 when unknown
+size_t PeakMemoryUsage();
+
+// Conversion options
+struct ConvertOptions {
+    unsigned threads = 0; // 0 uses every hardware thread
+    bool optimize_vertex_cache = false;
+    bool optimize_vertex_fetch = false;
+    bool index16 = false;
+    bool split_index16 = false; // Split render meshes to fit 16-bit indices, LODs are not split
+    VertexFormat vertex_format = VertexFormat::Float;
+    std::vector<float> lod_ratios; // Triangle ratio of each LOD, in decreasing order
+    size_t collision_triangles = 0; // Collision triangle budget, 0 for no limit
+    double collision_error = 0.0;   // Collision simplification distance error bound in model units, 0 for no bound
+    bool build_bvh = false;
+    bool build_meshlets = false;
+    bool shared_buffer = false;
+    bool legacy_ia = false;
+    size_t vertex_alignment = 64;
+    size_t index_alignment = 64;
+};
+
+// Materials of a converted model, the TMDL is made of them
+struct ModelMaterials {
+    std::map<std::string, std::string> material_textures;
+    std::map<std::string, size_t> material_parts; // Exported parts of every material with faces
+    std::map<std::string, std::pair<size_t, size_t>> material_ranges; // First index, index count in shared buffer mode
+};
+
+// Returns the text of the MTL file named by a mtllib command
+using MtlLoader = std::function<std::string(const std::string& mtl_name)>;
+
+// Writes a file of the model data directory to the stream
+using OutputWriter = std::function<void(std::ostream& stream)>;
+
+// Receives every file of the model data directory as soon as it is made, named relative to the
+// directory. The sink opens where the file goes and runs write on it, the file is streamed there
+using OutputSink = std::function<void(const std::string& file_name, const OutputWriter& write)>;
+
+// Adds the textures (map_Kd) of the materials of MTL text
+void ParseMtl(std::string_view mtl, std::map<std::string, std::string>& material_textures);
+
+// What a conversion keeps for the next conversion of the same model: the parsed OBJ chunks, and
+// the meshes of the materials and of the collision as assembled, with the files made of them
+class ConvertCache {
+public:
+    struct State;
+    std::shared_ptr<State> state; // Of the last conversion, none before the first one or after a failed one
+
+    // Data directory files of the last conversion in output order, the written and the kept ones
+    std::vector<std::string> Files() const;
+
+    void Clear() {
+        state.reset();
+    }
+};
+
+// Converts OBJ text into the files of a model data directory. Nothing is read or written
+// but through load_mtl and output, data_path only names the files in the log. Phases are
+// timed into stats when given, the time spent in load_mtl and output included.
+// With a cache, the OBJ text is split where its content says so that an edit leaves the other
+// chunks as they were, and only chunks missing from the cache are parsed. Materials and the
+// collision mesh that assemble into the meshes of the cache keep the files of the last conversion,
+// they are not output again. A cache only holds for the same options and output
+ModelMaterials ConvertObj(std::string_view obj, const MtlLoader& load_mtl, const OutputSink& output, const ConvertOptions& options, Log& log, const std::filesystem::path& data_path = {}, ConvertStats* stats = nullptr, ConvertCache* cache = nullptr);
+
+// Sets the draw entries of a converted model in a TMDL, other entries and keys already there are kept
+void UpdateTMDL(nlohmann::json& tmdl, const std::string& model_name, const ModelMaterials& materials, const ConvertOptions& options);
+
+// Model converted in memory. The TMDL refers to files as "<model name>/<file name>"
+struct ConvertedModel {
+    std::map<std::string, std::string> files; // Data directory files by name
+    ModelMaterials materials;
+    nlohmann::json tmdl;
+};
+
+ConvertedModel ConvertObjToMemory(std::string_view obj, const MtlLoader& load_mtl, const std::string& model_name, const ConvertOptions& options, Log& log, ConvertStats* stats = nullptr);
+
+} // namespace obj2tsr3
@@ -0,0 +1,1015 @@
+#pragma once
+
+// Internals of libobj2tsr3 shared by its sources, not part of the library interface
+
+#include "libobj2tsr3.h"
+
+namespace obj2tsr3::detail {
+
+// Post-transform vertex cache efficiency of a triangle list
+struct VertexCacheStats {
+    float acmr; // Average cache miss ratio, transformed vertices per triangle
+    float atvr; // Average transform to vertex ratio, transformed vertices per vertex
+};
+
+// Simulates a FIFO cache of cache_size entries
+VertexCacheStats AnalyzeVertexCache(const std::vector<size_t>& indices, size_t num_vertices, size_t cache_size = 16);
+
+// Reorders triangles for the post-transform vertex cache (Tipsify, Sander et al. 2007)
+void OptimizeVertexCache(std::vector<size_t>& indices, size_t num_vertices, size_t cache_size = 16);
+
+// Symmetric 4x4 error quadric of a set of planes (Garland & Heckbert 1997)
+struct Quadric {
+    double a[10] = {};
+
+    void AddPlane(double nx, double ny, double nz, double d) {
+        a[0] += nx * nx; a[1] += nx * ny; a[2] += nx * nz; a[3] += nx * d;
+        a[4] += ny * ny; a[5] += ny * nz; a[6] += ny * d;
+        a[7] += nz * nz; a[8] += nz * d;
+        a[9] += d * d;
+    }
+
+    void Add(const Quadric& q) {
+        for (size_t i = 0; i < 10; i++) a[i] += q.a[i];
+    }
+
+    // Sum of squared distances of (x, y, z) to the planes
+    double Error(double x, double y, double z) const {
+        double error = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+            + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+            + a[7] * z * z + 2 * a[8] * z
+            + a[9];
+
+        return std::max(error, 0.0);
+    }
+};
+
+// Squared attribute errors of a set of triangles, (g . p + d - a)^2 for every triangle and attribute,
+// where g and d interpolate the attribute linearly over the triangle (Hoppe 1999). An attribute that
+// varies linearly over the triangles, such as the uv of a planar mapping, has no error
+template<size_t num_attributes>
+struct AttributeQuadric {
+    Quadric gradients; // (g . p + d)^2 summed over the attributes
+    std::array<std::array<double, 4>, num_attributes> linear = {}; // g and d of each attribute, summed
+    double count = 0.0; // Triangles
+
+    // Adds a triangle, g and d of each attribute
+    void AddTriangle(const std::array<std::array<double, 4>, num_attributes>& triangle) {
+        for (size_t i = 0; i < num_attributes; i++) {
+            const auto& g = triangle[i];
+            gradients.AddPlane(g[0], g[1], g[2], g[3]);
+
+            for (size_t j = 0; j < 4; j++) linear[i][j] += g[j];
+        }
+
+        count += 1.0;
+    }
+
+    void Add(const AttributeQuadric& q) {
+        gradients.Add(q.gradients);
+
+        for (size_t i = 0; i < num_attributes; i++)
+            for (size_t j = 0; j < 4; j++) linear[i][j] += q.linear[i][j];
+
+        count += q.count;
+    }
+
+    // Error of the attributes of vertex from its 4th element on, at position p
+    template<typename Vertex>
+    double Error(const std::array<double, 3>& p, const Vertex& vertex) const {
+        double error = gradients.Error(p[0], p[1], p[2]);
+
+        for (size_t i = 0; i < num_attributes; i++) {
+            double a = vertex[3 + i];
+            double interpolated = linear[i][0] * p[0] + linear[i][1] * p[1] + linear[i][2] * p[2] + linear[i][3];
+
+            error += count * a * a - 2.0 * a * interpolated;
+        }
+
+        return std::max(error, 0.0);
+    }
+};
+
+// Edge collapse simplification with quadric error metrics. A collapse moves a vertex onto one of
+// its neighbours, so no new vertices are made and attributes are never interpolated, their change
+// is measured with attribute quadrics instead. Vertices sharing their position (uv / normal seams,
+// flat shading creases) are welded: a seam vertex only moves along its seam, together with its
+// partner on the other side. Vertices on open edges (material borders, holes), vertices where more
+// than two vertices share a position and vertices where a seam ends are never moved. Errors are
+// distances in model units, from every original vertex to the planes of its original triangles
+template<size_t size>
+class Simplifier {
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    struct Collapse {
+        double cost;
+        uint32_t from, to;
+        uint32_t from_version, to_version;
+
+        bool operator<(const Collapse& rhs) const {
+            if (cost != rhs.cost) return cost > rhs.cost;
+            if (from != rhs.from) return from > rhs.from;
+            return to > rhs.to;
+        }
+    };
+
+    // Collapse of from to to, with the collapse of the seam partner of from (none when from is not on a seam)
+    struct Target {
+        uint32_t to;
+        uint32_t from2, to2;
+    };
+
+    // Triangles around a vertex, a range of adjacency with room for capacity of them
+    struct AdjacencyRange {
+        uint32_t begin, count, capacity;
+    };
+
+    // Edges of a vertex without a triangle on their other side, see OpenEdges
+    struct OpenEdgeCount {
+        uint32_t count;
+        uint32_t out, in;
+    };
+
+    const std::vector<Vec<size>>& vertices;
+    std::vector<std::array<uint32_t, 3>> triangles;
+    std::vector<bool> triangle_removed;
+    std::vector<AdjacencyRange> adjacency_ranges; // Triangles left around each vertex, in compressed rows
+    std::vector<uint32_t> adjacency;                // grown at the end when a collapse overflows a row
+    std::vector<uint32_t> positions;  // First vertex at the position of each vertex
+    std::vector<uint32_t> wedges;     // Next vertex at the same position, a cycle
+    std::vector<uint32_t> num_wedges; // Vertices at each position, by first vertex
+    std::vector<Quadric> quadrics;    // Planes around each position, by first vertex
+    std::vector<uint32_t> plane_offsets;           // Original planes around each position, a range of planes by first vertex
+    std::vector<std::array<double, 4>> planes;
+    std::vector<uint32_t> merged_next, merged_last; // Original vertices moved onto each vertex, a list
+    std::vector<AttributeQuadric<size - 3>> attribute_quadrics;
+    std::vector<bool> locked;
+    std::vector<bool> vertex_removed;
+    std::vector<uint32_t> versions;
+    std::vector<Collapse> queue;
+
+    // Open edges of each vertex, recomputed once a collapse changed the triangles around it
+    std::vector<OpenEdgeCount> open_edges;
+    std::vector<bool> open_edges_valid;
+
+    // Vertex marks of the current stamp, and scratch lists reused by every collapse
+    std::vector<uint32_t> marks;
+    uint32_t mark = 0;
+    std::vector<uint32_t> target_neighbours, from_neighbours, to_neighbours, apply_neighbours, touched, moved;
+    std::vector<Target> targets;
+
+    size_t num_triangles = 0;
+    double attribute_weight = 0.0;
+    double max_error = 0.0;
+    double total_error = 0.0;
+    size_t num_collapses = 0;
+
+public:
+    explicit Simplifier(const IndexedArray<size>& mesh) : vertices(mesh.out_vertices) {
+        size_t num_vertices = vertices.size();
+
+        quadrics.resize(num_vertices);
+        attribute_quadrics.resize(size > 3 ? num_vertices : 0);
+        locked.assign(num_vertices, false);
+        vertex_removed.assign(num_vertices, false);
+        versions.assign(num_vertices, 0);
+        open_edges.resize(num_vertices);
+        open_edges_valid.assign(num_vertices, false);
+        marks.assign(num_vertices, 0);
+
+        merged_next.assign(num_vertices, none);
+        merged_last.resize(num_vertices);
+        for (uint32_t v = 0; v < num_vertices; v++) merged_last[v] = v;
+
+        // Degenerate triangles are dropped up front
+        for (size_t i = 0; i + 2 < mesh.out_indices.size(); i += 3) {
+            std::array<uint32_t, 3> triangle = { (uint32_t)mesh.out_indices[i], (uint32_t)mesh.out_indices[i + 1], (uint32_t)mesh.out_indices[i + 2] };
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2]) continue;
+
+            triangles.push_back(triangle);
+        }
+
+        adjacency_ranges.assign(num_vertices, AdjacencyRange{ 0, 0, 0 });
+        for (const auto& triangle : triangles)
+            for (const auto v : triangle) adjacency_ranges[v].capacity++;
+
+        uint32_t begin = 0;
+        for (auto& range : adjacency_ranges) {
+            range.begin = begin;
+            begin += range.capacity;
+        }
+
+        adjacency.resize(begin);
+        for (uint32_t t = 0; t < triangles.size(); t++) {
+            for (const auto v : triangles[t]) {
+                auto& range = adjacency_ranges[v];
+                adjacency[range.begin + range.count++] = t;
+            }
+        }
+
+        triangle_removed.assign(triangles.size(), false);
+        num_triangles = triangles.size();
+
+        WeldPositions();
+
+        // Plane quadrics of the positions, attribute quadrics of the vertices
+        std::vector<std::array<double, 4>> triangle_planes(triangles.size(), std::array<double, 4>{ 0.0, 0.0, 0.0, 0.0 });
+
+        for (size_t t = 0; t < triangles.size(); t++) {
+            const auto& triangle = triangles[t];
+            auto p0 = Position(triangle[0]), p1 = Position(triangle[1]), p2 = Position(triangle[2]);
+
+            double normal[3];
+            if (TriangleNormal(p0, p1, p2, normal) == 0.0) continue;
+
+            double d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+            for (const auto v : triangle) quadrics[positions[v]].AddPlane(normal[0], normal[1], normal[2], d);
+            triangle_planes[t] = { normal[0], normal[1], normal[2], d };
+
+            if (size == 3) continue;
+
+            // Attribute gradients g in the triangle plane, with g . (pi - p0) = ai - a0
+            double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+            double d11 = e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2];
+            double d12 = e1[0] * e2[0] + e1[1] * e2[1] + e1[2] * e2[2];
+            double d22 = e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2];
+            double det = d11 * d22 - d12 * d12;
+            if (det <= 0.0) continue;
+
+            std::array<std::array<double, 4>, size - 3> gradients;
+
+            for (size_t i = 0; i < size - 3; i++) {
+                double a0 = vertices[triangle[0]][3 + i];
+                double da1 = vertices[triangle[1]][3 + i] - a0;
+                double da2 = vertices[triangle[2]][3 + i] - a0;
+
+                double alpha = (da1 * d22 - da2 * d12) / det;
+                double beta = (da2 * d11 - da1 * d12) / det;
+
+                auto& g = gradients[i];
+                for (size_t j = 0; j < 3; j++) g[j] = alpha * e1[j] + beta * e2[j];
+                g[3] = a0 - (g[0] * p0[0] + g[1] * p0[1] + g[2] * p0[2]);
+            }
+
+            for (const auto v : triangle) attribute_quadrics[v].AddTriangle(gradients);
+        }
+
+        // The same planes listed by position, for Distance
+        plane_offsets.assign(num_vertices + 1, 0);
+        for (const auto& triangle : triangles)
+            for (const auto v : triangle) plane_offsets[positions[v] + 1]++;
+
+        for (size_t v = 0; v < num_vertices; v++) plane_offsets[v + 1] += plane_offsets[v];
+
+        planes.resize(plane_offsets[num_vertices]);
+        std::vector<uint32_t> fill(plane_offsets.begin(), plane_offsets.end() - 1);
+
+        for (size_t t = 0; t < triangles.size(); t++)
+            for (const auto v : triangles[t]) planes[fill[positions[v]]++] = triangle_planes[t];
+
+        LockBorders();
+
+        // Attribute errors are weighted as 1% of the mesh size
+        if (num_vertices > 0) {
+            double min[3], max[3];
+            for (size_t i = 0; i < 3; i++) min[i] = max[i] = vertices[0][i];
+
+            for (const auto& vertex : vertices) {
+                for (size_t i = 0; i < 3; i++) {
+                    min[i] = std::min(min[i], (double)vertex[i]);
+                    max[i] = std::max(max[i], (double)vertex[i]);
+                }
+            }
+
+            double diagonal = std::sqrt((max[0] - min[0]) * (max[0] - min[0]) + (max[1] - min[1]) * (max[1] - min[1]) + (max[2] - min[2]) * (max[2] - min[2]));
+            attribute_weight = (0.01 * diagonal) * (0.01 * diagonal);
+        }
+
+        for (uint32_t v = 0; v < num_vertices; v++) PushCollapses(v);
+        std::make_heap(queue.begin(), queue.end());
+    }
+
+    // Collapse edges until at most target_triangles remain or every remaining
+    // collapse would move geometry further than max_distance
+    void Simplify(size_t target_triangles, double max_distance = std::numeric_limits<double>::infinity()) {
+        while (num_triangles > target_triangles && !queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end());
+            Collapse collapse = queue.back();
+            queue.pop_back();
+
+            if (Stale(collapse)) continue;
+
+            // The seam partner of from may have changed since the collapse was queued
+            Target target;
+            if (!FindTarget(collapse.from, collapse.to, target)) continue;
+
+            // Distance first, it is cheaper than the topology checks and rejects most collapses
+            // once the bound is near
+            double distance = Distance(collapse.from, target.to);
+            if (target.from2 != none) distance = std::max(distance, Distance(target.from2, target.to2));
+            if (distance > max_distance) continue;
+
+            if (!CanCollapse(collapse.from, target.to)) continue;
+            if (target.from2 != none && !CanCollapse(target.from2, target.to2)) continue;
+
+            Apply(collapse, target, distance);
+        }
+    }
+
+    // Remaining triangles in their original order
+    std::vector<size_t> Indices() const {
+        std::vector<size_t> indices;
+        indices.reserve(num_triangles * 3);
+
+        for (size_t t = 0; t < triangles.size(); t++) {
+            if (triangle_removed[t]) continue;
+            for (const auto v : triangles[t]) indices.push_back(v);
+        }
+
+        return indices;
+    }
+
+    size_t NumTriangles() const { return num_triangles; }
+
+    // Largest and mean distance error of the collapses so far, in model units
+    double MaxError() const { return max_error; }
+    double MeanError() const { return num_collapses ? total_error / (double)num_collapses : 0.0; }
+
+private:
+    std::array<double, 3> Position(uint32_t v) const {
+        return { vertices[v][0], vertices[v][1], vertices[v][2] };
+    }
+
+    // Unit normal in normal, returns twice the area
+    static double TriangleNormal(const std::array<double, 3>& a, const std::array<double, 3>& b, const std::array<double, 3>& c, double normal[3]) {
+        double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+        double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length == 0.0) return 0.0;
+
+        for (size_t i = 0; i < 3; i++) normal[i] /= length;
+        return length;
+    }
+
+    void WeldPositions() {
+        IndexedArray<3> welded;
+        for (const auto& vertex : vertices) welded.OutVertex({ { vertex[0], vertex[1], vertex[2] } });
+
+        std::vector<uint32_t> first(welded.out_vertices.size(), none);
+
+        positions.resize(vertices.size());
+        wedges.resize(vertices.size());
+        num_wedges.assign(vertices.size(), 0);
+
+        for (uint32_t v = 0; v < vertices.size(); v++) {
+            uint32_t& p = first[welded.out_indices[v]];
+
+            if (p == none) {
+                p = v;
+                wedges[v] = v;
+            } else {
+                wedges[v] = wedges[p];
+                wedges[p] = v;
+            }
+
+            positions[v] = p;
+            num_wedges[p]++;
+        }
+    }
+
+    void LockBorders() {
+        // Edges between positions used by other than one triangle each way
+        std::vector<uint64_t> edges;
+        edges.reserve(triangles.size() * 3);
+
+        for (const auto& triangle : triangles) {
+            for (size_t i = 0; i < 3; i++)
+                edges.push_back((uint64_t)positions[triangle[i]] << 32 | positions[triangle[(i + 1) % 3]]);
+        }
+
+        std::sort(edges.begin(), edges.end());
+
+        for (size_t i = 0; i < edges.size(); ) {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i]) j++;
+
+            uint64_t reverse = (edges[i] & 0xffffffff) << 32 | edges[i] >> 32;
+            auto range = std::equal_range(edges.begin(), edges.end(), reverse);
+
+            if (j - i != 1 || range.second - range.first != 1) {
+                locked[edges[i] >> 32] = true;
+                locked[edges[i] & 0xffffffff] = true;
+            }
+
+            i = j;
+        }
+
+        // Locks are set on the first vertex of a position, then on all of its vertices
+        for (size_t v = 0; v < vertices.size(); v++)
+            if (locked[positions[v]] || num_wedges[positions[v]] > 2) locked[v] = true;
+    }
+
+    // New stamp for marks
+    uint32_t NextMark() {
+        if (++mark == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            mark = 1;
+        }
+
+        return mark;
+    }
+
+    // Runs f on the triangles left around v
+    template<typename F>
+    void ForEachTriangle(uint32_t v, F f) const {
+        const auto& range = adjacency_ranges[v];
+
+        for (uint32_t i = range.begin; i < range.begin + range.count; i++)
+            f(adjacency[i]);
+    }
+
+    // Removes a triangle from the row of v
+    void Unlink(uint32_t v, uint32_t t) {
+        auto& range = adjacency_ranges[v];
+        auto row = adjacency.begin() + range.begin;
+
+        auto end = std::remove(row, row + range.count, t);
+        range.count = (uint32_t)(end - row);
+    }
+
+    // Appends triangles to the row of v, moving the row to the end of adjacency with twice the
+    // room when it is full. Rows are packed again once the moved ones hold as much as the others
+    void Append(uint32_t v, const std::vector<uint32_t>& row_triangles) {
+        auto& range = adjacency_ranges[v];
+        size_t count = range.count + row_triangles.size();
+
+        if (count > range.capacity) {
+            if (adjacency.size() + count * 2 > triangles.size() * 6) PackAdjacency();
+
+            uint32_t begin = (uint32_t)adjacency.size();
+            adjacency.resize(adjacency.size() + count * 2);
+            std::copy(adjacency.begin() + range.begin, adjacency.begin() + range.begin + range.count, adjacency.begin() + begin);
+
+            range.begin = begin;
+            range.capacity = (uint32_t)(count * 2);
+        }
+
+        std::copy(row_triangles.begin(), row_triangles.end(), adjacency.begin() + range.begin + range.count);
+        range.count = (uint32_t)count;
+    }
+
+    void PackAdjacency() {
+        std::vector<uint32_t> packed;
+        packed.reserve(triangles.size() * 3);
+
+        for (auto& range : adjacency_ranges) {
+            uint32_t begin = (uint32_t)packed.size();
+            packed.insert(packed.end(), adjacency.begin() + range.begin, adjacency.begin() + range.begin + range.count);
+
+            range.begin = begin;
+            range.capacity = range.count;
+        }
+
+        adjacency.swap(packed);
+    }
+
+    bool HasCorner(uint32_t t, uint32_t v) const {
+        const auto& triangle = triangles[t];
+        return triangle[0] == v || triangle[1] == v || triangle[2] == v;
+    }
+
+    void Neighbours(uint32_t v, std::vector<uint32_t>& neighbours) {
+        neighbours.clear();
+        uint32_t stamp = NextMark();
+
+        ForEachTriangle(v, [&](uint32_t t) {
+            for (const auto u : triangles[t]) {
+                if (u == v || marks[u] == stamp) continue;
+
+                marks[u] = stamp;
+                neighbours.push_back(u);
+            }
+        });
+    }
+
+    // Edges of v without a triangle on their other side between the same vertices, out and in
+    // are the neighbours of the last one leaving and entering v
+    const OpenEdgeCount& OpenEdges(uint32_t v) {
+        auto& open = open_edges[v];
+        if (open_edges_valid[v]) return open;
+
+        // Neighbour after and before v in a triangle
+        auto Corner = [&](uint32_t t, size_t offset) {
+            const auto& triangle = triangles[t];
+            size_t corner = triangle[0] == v ? 0 : triangle[1] == v ? 1 : 2;
+            return triangle[(corner + offset) % 3];
+        };
+
+        open = { 0, none, none };
+
+        ForEachTriangle(v, [&](uint32_t t) {
+            uint32_t next = Corner(t, 1), prev = Corner(t, 2);
+            bool next_closed = false, prev_closed = false;
+
+            ForEachTriangle(v, [&](uint32_t u) {
+                next_closed = next_closed || Corner(u, 2) == next;
+                prev_closed = prev_closed || Corner(u, 1) == prev;
+            });
+
+            if (!next_closed) { open.out = next; open.count++; }
+            if (!prev_closed) { open.in = prev; open.count++; }
+        });
+
+        open_edges_valid[v] = true;
+        return open;
+    }
+
+    // Collapses of a seam vertex along its seam, with its partner following it along the seam
+    // edge that runs the other way on the other side. Returns their number
+    size_t SeamTargets(uint32_t from, Target seam_targets[2]) {
+        uint32_t from2 = wedges[from];
+        const auto& open = OpenEdges(from);
+        const auto& open2 = OpenEdges(from2);
+
+        if (open.count != 2 || open.out == none || open.in == none || open.out == open.in) return 0;
+        if (open2.count != 2 || open2.out == none || open2.in == none) return 0;
+        if (positions[open.out] != positions[open2.in] || positions[open.in] != positions[open2.out]) return 0;
+
+        seam_targets[0] = { open.out, from2, open2.in };
+        seam_targets[1] = { open.in, from2, open2.out };
+        return 2;
+    }
+
+    // Collapses of from, to any neighbour inside a surface, along the seam on a seam
+    void Targets(uint32_t from, std::vector<Target>& from_targets) {
+        from_targets.clear();
+        if (locked[from] || vertex_removed[from]) return;
+
+        if (num_wedges[positions[from]] == 1) {
+            // Open edges end a seam here
+            if (OpenEdges(from).count != 0) return;
+
+            Neighbours(from, target_neighbours);
+
+            for (const auto to : target_neighbours) from_targets.push_back({ to, none, none });
+            return;
+        }
+
+        Target seam_targets[2];
+        size_t num_targets = SeamTargets(from, seam_targets);
+        from_targets.assign(seam_targets, seam_targets + num_targets);
+    }
+
+    // The collapse of from to to among the Targets of from, without listing them
+    bool FindTarget(uint32_t from, uint32_t to, Target& target) {
+        if (locked[from] || vertex_removed[from]) return false;
+
+        if (num_wedges[positions[from]] == 1) {
+            if (OpenEdges(from).count != 0) return false;
+
+            bool neighbour = false;
+            ForEachTriangle(from, [&](uint32_t t) { neighbour = neighbour || HasCorner(t, to); });
+
+            target = { to, none, none };
+            return neighbour;
+        }
+
+        Target seam_targets[2];
+        size_t num_targets = SeamTargets(from, seam_targets);
+
+        for (size_t i = 0; i < num_targets; i++) {
+            if (seam_targets[i].to != to) continue;
+
+            target = seam_targets[i];
+            return true;
+        }
+
+        return false;
+    }
+
+    // Distance error of moving the original vertices merged into from to to, the largest distance
+    // of to from the planes of the original triangles around any of them
+    double Distance(uint32_t from, uint32_t to) const {
+        auto p = Position(to);
+        double error = 0.0;
+
+        for (uint32_t u = from; u != none; u = merged_next[u]) {
+            uint32_t position = positions[u];
+
+            for (uint32_t i = plane_offsets[position]; i < plane_offsets[position + 1]; i++) {
+                const auto& plane = planes[i];
+                error = std::max(error, std::abs(plane[0] * p[0] + plane[1] * p[1] + plane[2] * p[2] + plane[3]));
+            }
+        }
+
+        return error;
+    }
+
+    double AttributeError(uint32_t from, uint32_t to) const {
+        if (size == 3) return 0.0;
+
+        auto q = attribute_quadrics[from];
+        q.Add(attribute_quadrics[to]);
+
+        return q.Error(Position(to), vertices[to]);
+    }
+
+    // A collapse queued before one of its vertices was removed or changed, it never becomes valid again
+    bool Stale(const Collapse& collapse) const {
+        if (vertex_removed[collapse.from] || vertex_removed[collapse.to]) return true;
+        return versions[collapse.from] != collapse.from_version || versions[collapse.to] != collapse.to_version;
+    }
+
+    // Appends the collapses of from to the queue, or only those onto the position of onto when given.
+    // The other collapses of a vertex inside a surface keep their cost and their queued entries stay
+    // valid. The caller restores the heap
+    void PushCollapses(uint32_t from, uint32_t onto = none) {
+        Targets(from, targets);
+        bool seam = num_wedges[positions[from]] != 1;
+
+        for (const auto& target : targets) {
+            uint32_t to = target.to;
+            if (onto != none && !seam && positions[to] != positions[onto]) continue;
+
+            Quadric q = quadrics[positions[from]];
+            q.Add(quadrics[positions[to]]);
+
+            double error = q.Error(vertices[to][0], vertices[to][1], vertices[to][2]);
+
+            double attribute_error = AttributeError(from, to);
+            if (target.from2 != none) attribute_error += AttributeError(target.from2, target.to2);
+
+            queue.push_back({ error + attribute_weight * attribute_error, from, to, versions[from], versions[to] });
+        }
+    }
+
+    bool CanCollapse(uint32_t from, uint32_t to) {
+        // Link condition, from and to may only share the vertices opposite their common edge
+        Neighbours(from, from_neighbours);
+        Neighbours(to, to_neighbours);
+
+        size_t shared_triangles = 0;
+        ForEachTriangle(from, [&](uint32_t t) {
+            if (HasCorner(t, to)) shared_triangles++;
+        });
+
+        uint32_t stamp = NextMark();
+        for (const auto v : to_neighbours) marks[v] = stamp;
+
+        size_t shared_neighbours = 0;
+        for (const auto v : from_neighbours)
+            if (marks[v] == stamp) shared_neighbours++;
+
+        if (shared_neighbours != shared_triangles) return false;
+
+        // Moved triangles must not flip, nor end with two corners at one position
+        auto target = Position(to);
+        bool flips = false;
+
+        ForEachTriangle(from, [&](uint32_t t) {
+            if (flips || HasCorner(t, to)) return;
+
+            const auto& triangle = triangles[t];
+
+            std::array<double, 3> corners[3], moved[3];
+            for (size_t i = 0; i < 3; i++) {
+                corners[i] = Position(triangle[i]);
+                moved[i] = triangle[i] == from ? target : corners[i];
+            }
+
+            double before[3], after[3];
+            if (TriangleNormal(corners[0], corners[1], corners[2], before) == 0.0) return;
+            if (TriangleNormal(moved[0], moved[1], moved[2], after) == 0.0) { flips = true; return; }
+
+            if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0) flips = true;
+        });
+
+        return !flips;
+    }
+
+    // Moves the triangles of from to to, the ones they share are removed
+    void Move(uint32_t from, uint32_t to) {
+        moved.clear();
+
+        ForEachTriangle(from, [&](uint32_t t) {
+            if (HasCorner(t, to)) {
+                triangle_removed[t] = true;
+                num_triangles--;
+
+                for (const auto v : triangles[t])
+                    if (v != from) Unlink(v, t);
+
+                return;
+            }
+
+            for (auto& v : triangles[t])
+                if (v == from) v = to;
+
+            moved.push_back(t);
+        });
+
+        adjacency_ranges[from].count = 0;
+        Append(to, moved);
+
+        vertex_removed[from] = true;
+
+        merged_next[merged_last[to]] = from;
+        merged_last[to] = merged_last[from];
+
+        if (size > 3) attribute_quadrics[to].Add(attribute_quadrics[from]);
+    }
+
+    void Apply(const Collapse& collapse, const Target& target, double distance) {
+        uint32_t to = collapse.to;
+
+        // Positions around the moved vertices, their open edges change
+        touched.clear();
+        uint32_t stamp = NextMark();
+
+        auto Touch = [&](uint32_t v) {
+            uint32_t u = v;
+            do {
+                if (marks[u] != stamp) {
+                    marks[u] = stamp;
+                    touched.push_back(u);
+                }
+
+                u = wedges[u];
+            } while (u != v);
+        };
+
+        for (const auto from : { collapse.from, target.from2 }) {
+            if (from == none) continue;
+
+            ForEachTriangle(from, [&](uint32_t t) {
+                for (const auto u : triangles[t]) Touch(u);
+            });
+        }
+
+        for (const auto v : touched) open_edges_valid[v] = false;
+
+        Move(collapse.from, to);
+        if (target.from2 != none) Move(target.from2, target.to2);
+
+        quadrics[positions[to]].Add(quadrics[positions[collapse.from]]);
+
+        max_error = std::max(max_error, distance);
+        total_error += distance;
+        num_collapses++;
+
+        // Collapses into and out of the vertices at the position of to have new costs
+        uint32_t v = to;
+        do {
+            versions[v]++;
+            v = wedges[v];
+        } while (v != to);
+
+        size_t queued = queue.size();
+        do {
+            Neighbours(v, apply_neighbours);
+
+            PushCollapses(v);
+            for (const auto u : apply_neighbours) PushCollapses(u, to);
+
+            v = wedges[v];
+        } while (v != to);
+
+        while (queued < queue.size()) std::push_heap(queue.begin(), queue.begin() + ++queued);
+    }
+};
+
+// Binary output, small values are gathered and written to the stream in large blocks
+class BlockWriter {
+    std::ostream& stream;
+    std::vector<char> buffer;
+    size_t used = 0;
+    uint64_t written = 0;
+
+public:
+    static constexpr size_t capacity = 1 << 20;
+
+    explicit BlockWriter(std::ostream& stream) : stream(stream), buffer(capacity) {}
+
+    ~BlockWriter() {
+        Flush();
+    }
+
+    template<typename T>
+    void Put(T value) {
+        if (used + sizeof(T) > capacity) Flush();
+
+        std::memcpy(buffer.data() + used, &value, sizeof(T));
+        used += sizeof(T);
+    }
+
+    void PutBytes(const void* data, size_t count) {
+        if (used + count > capacity) Flush();
+
+        // Large blocks skip the buffer
+        if (count >= capacity) {
+            Write((const char*)data, count);
+            return;
+        }
+
+        std::memcpy(buffer.data() + used, data, count);
+        used += count;
+    }
+
+    void Flush() {
+        if (used == 0) return;
+
+        Write(buffer.data(), used);
+        used = 0;
+    }
+
+    // Bytes put so far, buffered ones included
+    uint64_t Size() const {
+        return written + used;
+    }
+
+private:
+    void Write(const char* data, size_t count) {
+        stream.write(data, count);
+        written += count;
+    }
+};
+
+// Creates a binary file and puts its content with write(BlockWriter&), throws when it cannot be opened or written
+template<typename F>
+void WriteBinaryFile(const std::filesystem::path& path, F write) {
+    std::ofstream ofs(path, std::ofstream::binary);
+    if (!ofs.good()) throw std::runtime_error("Cannot open \"" + path.string() + "\" for output");
+
+    {
+        BlockWriter writer(ofs);
+        write(writer);
+    }
+
+    if (!ofs.good()) throw std::runtime_error("Cannot write \"" + path.string() + "\"");
+}
+
+// Largest vertex count addressable with uint16_t indices
+constexpr size_t max_index16_vertices = 65536;
+
+// Split into parts of at most max_vertices vertices, triangles keep their order
+template<size_t size>
+std::vector<IndexedArray<size>> SplitIndexedArray(const IndexedArray<size>& data, size_t max_vertices) {
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(data.out_vertices.size(), unused);
+    std::vector<size_t> touched;
+
+    std::vector<IndexedArray<size>> parts(1);
+
+    for (size_t t = 0; t + 2 < data.out_indices.size(); t += 3) {
+        const size_t* corners = &data.out_indices[t];
+
+        size_t new_vertices = (remap[corners[0]] == unused)
+            + (remap[corners[1]] == unused && corners[1] != corners[0])
+            + (remap[corners[2]] == unused && corners[2] != corners[0] && corners[2] != corners[1]);
+
+        if (parts.back().out_vertices.size() + new_vertices > max_vertices) {
+            for (const auto v : touched) remap[v] = unused;
+            touched.clear();
+            parts.emplace_back();
+        }
+
+        auto& part = parts.back();
+
+        for (size_t corner = 0; corner < 3; corner++) {
+            size_t v = corners[corner];
+
+            if (remap[v] == unused) {
+                remap[v] = (uint32_t)part.out_vertices.size();
+                part.out_vertices.push_back(data.out_vertices[v]);
+                touched.push_back(v);
+            }
+
+            part.out_indices.push_back(remap[v]);
+        }
+    }
+
+    return parts;
+}
+
+// Dequantization of quantized IA8 vertices, value = min + unorm * scale
+struct QuantizationBlock {
+    float position_min[3];
+    float position_scale[3];
+    float uv_min[2];
+    float uv_scale[2]; // Unused by Q16, its uvs are half floats
+};
+
+// Quantization range of IA8 vertices
+QuantizationBlock ComputeQuantization(const std::vector<Vec<8>>& vertices);
+
+// Size of a vertex in the vertices block
+template<size_t size>
+size_t VertexStride(const IAFormat& format) {
+    if (size != 8 || format.vertex_format == VertexFormat::Float) return sizeof(Vec<size>);
+    return format.vertex_format == VertexFormat::Q16 ? 16 : 12;
+}
+
+// Vertices as floats
+template<size_t size>
+void PutVertices(BlockWriter& writer, const std::vector<Vec<size>>& vertices, const IAFormat&, const QuantizationBlock&) {
+    writer.PutBytes(vertices.data(), vertices.size() * sizeof(Vec<size>));
+}
+
+// IA8 vertices in the vertex format, quantized with q
+void PutVertices(BlockWriter& writer, const std::vector<Vec<8>>& vertices, const IAFormat& format, const QuantizationBlock& q);
+
+// Writes an IA file, the layout is described at CreateIA
+template<size_t size>
+void WriteIA(BlockWriter& writer, const IndexedArray<size>& data, const IAFormat& format = {}) {
+    static_assert(sizeof(Vec<size>) == size * sizeof(float), "Vec must be tightly packed");
+
+    bool index16 = format.index16 && data.out_vertices.size() <= max_index16_vertices;
+    bool quantized = size == 8 && format.vertex_format != VertexFormat::Float;
+
+    QuantizationBlock q = {};
+    if constexpr (size == 8)
+        if (quantized) q = ComputeQuantization(data.out_vertices);
+
+    uint32_t extension_size = quantized ? sizeof(QuantizationBlock) : 0;
+
+    // Magic number
+    const char magic[4] = { 'I', 'A', (char)(size + '0'), '\0' };
+    writer.PutBytes(magic, sizeof(magic));
+
+    // Revision / reserved
+    char header[12] = {};
+
+    if (!format.legacy_layout)
+        header[0] = 3;
+    else if (quantized)
+        header[0] = 2;
+    else if (format.index16)
+        header[0] = 1;
+
+    if (header[0] != 0)
+        header[1] = index16 ? 2 : 4;
+
+    if (header[0] >= 2) {
+        header[2] = (char)(quantized ? format.vertex_format : VertexFormat::Float);
+        std::memcpy(&header[4], &extension_size, sizeof(extension_size));
+    }
+
+    writer.PutBytes(header, sizeof(header));
+
+    if (!format.legacy_layout) {
+        auto Align = [](size_t offset, size_t alignment) {
+            return (offset + alignment - 1) / alignment * alignment;
+        };
+
+        size_t extension_end = 32 + extension_size;
+        size_t vertex_offset = Align(extension_end, format.vertex_alignment);
+        size_t vertex_end = vertex_offset + data.out_vertices.size() * VertexStride<size>(format);
+        size_t index_offset = Align(vertex_end, format.index_alignment);
+
+        if (index_offset > std::numeric_limits<uint32_t>::max()) throw std::length_error("IA file too large");
+
+        writer.Put<uint32_t>((uint32_t)data.out_vertices.size());
+        writer.Put<uint32_t>((uint32_t)vertex_offset);
+        writer.Put<uint32_t>((uint32_t)data.out_indices.size());
+        writer.Put<uint32_t>((uint32_t)index_offset);
+
+        if (quantized) writer.PutBytes(&q, sizeof(q));
+
+        for (size_t i = extension_end; i < vertex_offset; i++) writer.Put<uint8_t>(0);
+        PutVertices(writer, data.out_vertices, format, q);
+        for (size_t i = vertex_end; i < index_offset; i++) writer.Put<uint8_t>(0);
+    } else {
+        // Vertices block, quantized formats are preceded by their QuantizationBlock
+        if (quantized) writer.PutBytes(&q, sizeof(q));
+
+        writer.Put<uint32_t>((uint32_t)data.out_vertices.size());
+        PutVertices(writer, data.out_vertices, format, q);
+
+        writer.Put<uint32_t>((uint32_t)data.out_indices.size());
+    }
+
+    // Indices block
+
+    if (index16) {
+        for (const auto index : data.out_indices)
+            writer.Put<uint16_t>((uint16_t)index);
+    } else {
+        for (const auto index : data.out_indices)
+            writer.Put<uint32_t>((uint32_t)index);
+    }
+}
+
+// Writes a BVH file, the layout is described at CreateBVH
+void WriteBVH(BlockWriter& writer, const BVH& bvh);
+
+// Writes a meshlet file, the layout is described at CreateMeshlets
+void WriteMeshlets(BlockWriter& writer, const MeshletData& data);
+
+} // namespace obj2tsr3::detail
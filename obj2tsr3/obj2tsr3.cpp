@@ -1,286 +1,881 @@
-#include <algorithm>
-#include <array>
-#include <filesystem>
-#include <fstream>
-#include <functional>
-#include <iostream>
-#include <map>
-#include <regex>
-#include <sstream>
-#include <stdexcept>
-#include <string>
-#include <vector>
+#include "libobj2tsr3.h"
 
-#include <nlohmann/json.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
 
 namespace fs = std::filesystem;
 
+using namespace obj2tsr3;
 using std::literals::string_literals::operator""s;
 
-// Vector type
-template<size_t size>
-class Vec {
-    float value[size];
-public:
-    Vec() {}
+// Size, modification time and content hash of a file
+struct FileStamp {
+    std::string path;
+    uint64_t size = 0;
+    int64_t time = 0;
+    uint64_t hash = 0;
+};
+
+// Stamp of a file whose content has been read, size and time are taken before the read
+FileStamp StampFile(const fs::path& path, std::string_view content, uint64_t size, int64_t time) {
+    return { fs::absolute(path).lexically_normal().string(), size, time, HashBytes(content) };
+}
+
+int64_t FileTime(const fs::path& path) {
+    return (int64_t)fs::last_write_time(path).time_since_epoch().count();
+}
+
+// Size and time of a file about to be read, zero when they cannot be taken
+void FileSizeTime(const fs::path& path, uint64_t& size, int64_t& time) {
+    std::error_code ec;
+    size = fs::file_size(path, ec);
+    time = ec ? 0 : FileTime(path);
+    if (ec) size = 0;
+}
+
+FileStamp StampFile(const fs::path& path) {
+    uint64_t size = fs::file_size(path);
+    int64_t time = FileTime(path);
+
+    FileView file(path);
+    return StampFile(path, file.View(), size, time);
+}
 
-    Vec(const std::array<float, size>& i_value) {
-        for (size_t i = 0; i < size; i++)
-            value[i] = i_value[i];
+// Bumped when the output of the same inputs and options changes
+constexpr uint32_t manifest_revision = 1;
+
+// Inputs, options and outputs of the last conversion, stored in the data directory.
+// A conversion is skipped when all of them are unchanged. Inputs whose size and time
+// match are not hashed again, touched inputs are hashed and compared.
+struct ConversionManifest {
+    nlohmann::json options;
+    std::vector<FileStamp> inputs; // The OBJ first, then its MTLs
+    std::vector<std::pair<std::string, uint64_t>> outputs; // Path, size
+
+    static fs::path Path(const fs::path& data_path) {
+        return data_path / fs::path("obj2tsr3.manifest");
     }
 
-    float& operator[](const size_t i) {
-        return value[i];
+    // Empty manifest when there is none or it cannot be read
+    static ConversionManifest Load(const fs::path& path) {
+        ConversionManifest manifest;
+
+        std::ifstream ifs(path);
+        if (!ifs.good()) return manifest;
+
+        try {
+            nlohmann::json json;
+            ifs >> json;
+
+            manifest.options = json.at("options");
+
+            for (const auto& input : json.at("inputs"))
+                manifest.inputs.push_back({ input.at("path").get<std::string>(), input.at("size").get<uint64_t>(), input.at("time").get<int64_t>(), input.at("hash").get<uint64_t>() });
+
+            for (const auto& output : json.at("outputs"))
+                manifest.outputs.push_back({ output.at("path").get<std::string>(), output.at("size").get<uint64_t>() });
+        } catch (const nlohmann::json::exception&) {
+            return ConversionManifest();
+        }
+
+        return manifest;
     }
 
-    const float& operator[](const size_t i) const {
-        return value[i];
+    void Save(const fs::path& path) const {
+        nlohmann::json json;
+        json["options"] = options;
+
+        auto& json_inputs = json["inputs"] = nlohmann::json::array();
+        for (const auto& input : inputs)
+            json_inputs.push_back({ { "path", input.path }, { "size", input.size }, { "time", input.time }, { "hash", input.hash } });
+
+        auto& json_outputs = json["outputs"] = nlohmann::json::array();
+        for (const auto& output : outputs)
+            json_outputs.push_back({ { "path", output.first }, { "size", output.second } });
+
+        std::ofstream ofs(path);
+        if (!ofs.good()) throw std::runtime_error("Cannot open manifest \""s + path.string() + "\" for output"s);
+        ofs << std::setw(4) << json;
+        if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
     }
 
-    bool operator==(const Vec<size>& rhs) const {
-        for (size_t i = 0; i < size; i++)
-            if (value[i] != rhs[i]) return false;
+    // Touched inputs whose content is unchanged take their new time and set touched,
+    // saving the manifest then spares hashing them again on the next run
+    bool UpToDate(const fs::path& obj_path, const nlohmann::json& current_options, bool& touched) {
+        touched = false;
+
+        if (inputs.empty() || inputs[0].path != fs::absolute(obj_path).lexically_normal().string() || options != current_options) return false;
+
+        std::error_code ec;
+
+        for (const auto& output : outputs)
+            if (fs::file_size(output.first, ec) != output.second || ec) return false;
+
+        for (auto& input : inputs) {
+            uint64_t size = fs::file_size(input.path, ec);
+            if (ec || size != input.size) return false;
+
+            if (FileTime(input.path) == input.time) continue;
+
+            FileStamp stamp = StampFile(input.path);
+            if (stamp.size != input.size || stamp.hash != input.hash) return false;
+
+            input.time = stamp.time;
+            touched = true;
+        }
 
         return true;
     }
 };
 
-// IA8 / IA3 generator
-template<size_t size>
-struct IndexedArray {
-    std::vector<Vec<size>> out_vertices;
-    std::vector<size_t> out_indices;
+// Command line options
+struct Options : ConvertOptions {
+    std::vector<std::string> obj_names;
+    std::string batch_name; // File listing OBJ files to convert, one per line
+    bool archive = false;
+    std::string unpack_name; // Archive to extract instead of converting
+    bool force = false; // Convert even when the manifest is up to date
+    bool watch = false;
+    bool stats = false;     // Print per-phase timing and counters of every conversion
+    std::string stats_json; // File the timing and counters are written to as JSON
+    std::string trace_name; // Chrome trace event file of the run
+
+    bool CollectStats() const {
+        return stats || !stats_json.empty();
+    }
+};
+
+VertexFormat ParseVertexFormat(const std::string& name) {
+    if (name == "float") return VertexFormat::Float;
+    if (name == "q16") return VertexFormat::Q16;
+    if (name == "q12") return VertexFormat::Q12;
 
-    void OutVertex(const Vec<size>& value) {
-        auto it = std::find(out_vertices.begin(), out_vertices.end(), value);
+    throw std::invalid_argument("Unknown vertex format \""s + name + "\""s);
+}
 
-        if (it == out_vertices.end()) {
-            out_vertices.push_back(value);
-            out_indices.push_back(out_vertices.size() - 1);
-        } else {
-            int index = it - out_vertices.begin();
-            out_indices.push_back(index);
-        }
+size_t ParseAlignment(const std::string& value) {
+    size_t alignment = (size_t)std::stoull(value);
+    if (alignment < 4 || alignment > 65536 || (alignment & (alignment - 1)) != 0)
+        throw std::invalid_argument("Alignment must be a power of two between 4 and 65536");
+
+    return alignment;
+}
+
+Options ParseOptions(int argc, char* argv[]) {
+    const char* usage =
+        "Usage: obj2tsr3 [options] <obj file name>...\n"
+        "       obj2tsr3 [options] --batch <list file name>\n"
+        "       obj2tsr3 --unpack <archive file name>\n"
+        "  --batch <list file>            Convert the OBJ files listed one per line, relative to the list\n"
+        "  --threads <count>              OBJ parser threads, models at once in batch mode (default: all)\n"
+        "  --vertex-cache                 Reorder triangles for the GPU vertex cache\n"
+        "  --vertex-fetch                 Reorder vertices in order of first use\n"
+        "  --index16                      Write 16-bit indices where they fit (IA revision 1)\n"
+        "  --split16                      Split materials so that every mesh fits 16-bit indices, LODs\n"
+        "                                 are not split and keep 32-bit indices when they do not fit\n"
+        "  --vertex-format <f>            IA8 vertex layout: float (32 bytes), q16 or q12 (IA revision 2)\n"
+        "  --lod <ratio>                  Add a simplified LOD with ratio of the triangles, repeatable\n"
+        "  --collision-triangles <count>  Simplify collision.ia3 to a triangle budget\n"
+        "  --collision-error <distance>   Simplify collision.ia3 up to a distance error in model units\n"
+        "  --bvh                          Build a SAH BVH over the collision mesh (collision.bvh)\n"
+        "  --meshlets                     Write meshlets with culling bounds next to each IA8\n"
+        "  --shared-buffer                Write all materials as index ranges of one IA8 (shared.ia8)\n"
+        "  --archive                      Also pack the TMDL and its files into one archive (<model>.tpk)\n"
+        "  --vertex-alignment <bytes>     IA vertices block alignment, a power of two (default: 64)\n"
+        "  --index-alignment <bytes>      IA indices block alignment, a power of two (default: 64)\n"
+        "  --legacy-ia                    Write the unaligned IA layout (revision 0 to 2) for older loaders\n"
+        "  --force                        Convert even when inputs and options match the last conversion\n"
+        "  --watch                        Keep converting whenever the OBJ, its MTLs or the TMDL change\n"
+        "  --stats                        Print the time, bytes and records of every conversion phase\n"
+        "  --stats-json <file>            Write the conversion phase statistics to a JSON report\n"
+        "  --trace <file>                 Write a Chrome trace (Perfetto, chrome://tracing) of the conversions";
+
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--threads" && i + 1 < argc)
+            options.threads = (unsigned)std::stoul(argv[++i]);
+        else if (arg == "--vertex-cache")
+            options.optimize_vertex_cache = true;
+        else if (arg == "--vertex-fetch")
+            options.optimize_vertex_fetch = true;
+        else if (arg == "--index16")
+            options.index16 = true;
+        else if (arg == "--split16")
+            options.index16 = options.split_index16 = true;
+        else if (arg == "--vertex-format" && i + 1 < argc)
+            options.vertex_format = ParseVertexFormat(argv[++i]);
+        else if (arg == "--lod" && i + 1 < argc) {
+            float ratio = std::stof(argv[++i]);
+            if (!(ratio > 0.0f && ratio < 1.0f)) throw std::invalid_argument("LOD ratio must be between 0 and 1");
+            options.lod_ratios.push_back(ratio);
+        } else if (arg == "--collision-triangles" && i + 1 < argc)
+            options.collision_triangles = (size_t)std::stoull(argv[++i]);
+        else if (arg == "--collision-error" && i + 1 < argc)
+            options.collision_error = std::stod(argv[++i]);
+        else if (arg == "--bvh")
+            options.build_bvh = true;
+        else if (arg == "--meshlets")
+            options.build_meshlets = true;
+        else if (arg == "--shared-buffer")
+            options.shared_buffer = true;
+        else if (arg == "--archive")
+            options.archive = true;
+        else if (arg == "--batch" && i + 1 < argc)
+            options.batch_name = argv[++i];
+        else if (arg == "--unpack" && i + 1 < argc)
+            options.unpack_name = argv[++i];
+        else if (arg == "--vertex-alignment" && i + 1 < argc)
+            options.vertex_alignment = ParseAlignment(argv[++i]);
+        else if (arg == "--index-alignment" && i + 1 < argc)
+            options.index_alignment = ParseAlignment(argv[++i]);
+        else if (arg == "--legacy-ia")
+            options.legacy_ia = true;
+        else if (arg == "--force")
+            options.force = true;
+        else if (arg == "--watch")
+            options.watch = true;
+        else if (arg == "--stats")
+            options.stats = true;
+        else if (arg == "--stats-json" && i + 1 < argc)
+            options.stats_json = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc)
+            options.trace_name = argv[++i];
+        else if (arg.rfind("--", 0) == 0)
+            throw std::invalid_argument("Unknown option \""s + arg + "\"\n"s + usage);
+        else
+            options.obj_names.push_back(arg);
     }
+
+    if (options.obj_names.empty() && options.batch_name.empty() && options.unpack_name.empty()) throw std::invalid_argument("Too few arguments\n"s + usage);
+
+    std::sort(options.lod_ratios.begin(), options.lod_ratios.end(), std::greater<float>());
+
+    if (options.shared_buffer && (options.split_index16 || options.build_meshlets))
+        throw std::invalid_argument("--shared-buffer cannot be combined with --split16 or --meshlets");
+
+    return options;
+}
+
+// Options that change the output, the manifest of a conversion records them
+nlohmann::json OptionsKey(const Options& options) {
+    nlohmann::json key;
+
+    key["revision"] = manifest_revision;
+    key["vertex_cache"] = options.optimize_vertex_cache;
+    key["vertex_fetch"] = options.optimize_vertex_fetch;
+    key["index16"] = options.index16;
+    key["split16"] = options.split_index16;
+    key["vertex_format"] = (int)options.vertex_format;
+    key["lod"] = options.lod_ratios;
+    key["collision_triangles"] = options.collision_triangles;
+    key["collision_error"] = options.collision_error;
+    key["bvh"] = options.build_bvh;
+    key["meshlets"] = options.build_meshlets;
+    key["shared_buffer"] = options.shared_buffer;
+    key["archive"] = options.archive;
+    key["legacy_ia"] = options.legacy_ia;
+    key["vertex_alignment"] = options.vertex_alignment;
+    key["index_alignment"] = options.index_alignment;
+
+    return key;
+}
+
+// Conversion results that the TMDL, the archive and the manifest are made of, watch mode keeps them between conversions
+struct ModelExport {
+    fs::path obj_path;
+    FileStamp obj_stamp;
+    std::vector<fs::path> mtl_paths;
+    // Stamps of the MTL bytes the materials were parsed from, taken while they were read. Stamping
+    // the files again when the manifest is saved would record an MTL edited in between as
+    // converted, and the edit would never be picked up
+    std::vector<FileStamp> mtl_stamps;
+    ModelMaterials materials;
+    std::vector<fs::path> exported_files; // Files of this export, packed by --archive
 };
 
-// OBJ / MTL parser
-void ParseFile(fs::path file_path, std::function<void(const std::string& command, std::istringstream& ls)> callback) {
-    std::ifstream ifs(file_path);
+// Writes the TMDL, merged into the current one, then the archive and the manifest of a converted model
+void ExportTMDL(const Options& options, const ModelExport& model, Log& log, ConvertStats* stats = nullptr) {
+    log.Printf("\nExporting TMDL...\n\n");
+
+    PhaseTimer tmdl_timer(stats, "TMDL update");
+
+    nlohmann::json tmdl;
+
+    fs::path current_path = fs::absolute(fs::current_path());
+    std::string model_name = model.obj_path.stem().string();
+    auto tmdl_path = current_path / fs::path(model_name + ".tmdl"s);
+
+    // Read current tmdl
+    if (fs::is_regular_file(tmdl_path)) {
+        std::ifstream tmdl_i(tmdl_path);
+        if (!tmdl_i.good()) throw std::runtime_error("Cannot open TMDL \""s + tmdl_path.string() + "\""s);
+        tmdl_i >> tmdl;
+        tmdl_i.close();
+    }
+
+    UpdateTMDL(tmdl, model_name, model.materials, options);
+
+    std::ofstream tmdl_o(tmdl_path);
+    if (!tmdl_o.good()) throw std::runtime_error("Cannot open TMDL \""s + tmdl_path.string() + "\" for output"s);
+    tmdl_o << std::setw(4) << tmdl;
+    tmdl_o.close();
+
+    tmdl_timer.Stop();
 
-    if (!ifs.good()) throw std::runtime_error("Cannot open \""s + file_path.string() + "\""s);
+    // Archive export, sections are named as the TMDL refers to them
+    auto archive_path = current_path / fs::path(model_name + ".tpk"s);
 
-    for (std::string line; std::getline(ifs, line); ) {
-        if (line[0] == '#' || line.empty()) continue;
+    if (options.archive) {
+        log.Printf("%-20s \"%s\"\n", "Archive: ", archive_path.string().c_str());
 
-        std::istringstream ls(line);
+        PhaseTimer timer(stats, "Archive");
 
-        std::string command;
-        ls >> command >> std::ws;
+        std::vector<std::pair<std::string, fs::path>> archive_files;
+        archive_files.push_back({ model_name + ".tmdl"s, tmdl_path });
 
-        callback(command, ls);
+        for (const auto& file : model.exported_files)
+            archive_files.push_back({ model_name + "/"s + file.filename().string(), file });
+
+        // Sections keep the alignment of the IA blocks within them
+        CreateArchive(archive_path, archive_files, std::max({ archive_alignment, options.vertex_alignment, options.index_alignment }));
+        timer.Count(fs::file_size(archive_path), archive_files.size());
+
+        log.Printf("%zu files, %llu bytes\n", archive_files.size(), (unsigned long long)fs::file_size(archive_path));
     }
-}
 
-template<typename T>
-void PutBytes(std::ostream& stream, T value) {
-    auto valueptr = (uint8_t*)(&value);
-    for (size_t i = 0; i < sizeof(T); i++)
-        stream << valueptr[i];
+    // Manifest of this conversion
+    PhaseTimer manifest_timer(stats, "Manifest save");
+
+    ConversionManifest manifest;
+    manifest.options = OptionsKey(options);
+
+    manifest.inputs.push_back(model.obj_stamp);
+    for (const auto& mtl_stamp : model.mtl_stamps)
+        manifest.inputs.push_back(mtl_stamp);
+
+    std::vector<fs::path> output_files = model.exported_files;
+    output_files.push_back(tmdl_path);
+    if (options.archive) output_files.push_back(archive_path);
+
+    for (const auto& file : output_files)
+        manifest.outputs.push_back({ fs::absolute(file).lexically_normal().string(), fs::file_size(file) });
+
+    manifest.Save(ConversionManifest::Path(current_path / model.obj_path.stem()));
+
 }
 
-template<size_t size>
-void CreateIA(fs::path path, const IndexedArray<size>& data) {
-    std::ofstream ofs(path, std::ofstream::binary);
+// Result of a model conversion
+enum class ConvertResult {
+    Converted,
+    UpToDate,
+};
+
+// Converts an OBJ file into a TMDL and its data directory in the current directory. With a cache,
+// the files of unchanged meshes are kept from the last conversion
+ConvertResult ConvertModel(const Options& options, const fs::path& obj_path, Log& log, ModelExport& model, ConvertStats* stats = nullptr, ConvertCache* cache = nullptr) {
+    TraceScope trace("model", obj_path);
+    auto start = std::chrono::steady_clock::now();
+
+    auto Finish = [&](ConvertResult result) {
+        if (stats) {
+            stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats->peak_memory = PeakMemoryUsage();
+        }
+
+        return result;
+    };
+
+    fs::path obj_dir_path = fs::absolute(obj_path).parent_path();
+    fs::path current_path = fs::absolute(fs::current_path());
+    fs::path obj_stem = obj_path.stem();
+    fs::path obj_data_path = fs::absolute(current_path / obj_stem);
+
+    auto DumpPath = [&](const std::string& desc, const fs::path& path) {
+        log.Printf("%-20s \"%s\"\n", desc.c_str(), path.string().c_str());
+    };
+
+    DumpPath("Source file:", obj_path);
+    DumpPath("Source directory:", obj_dir_path);
+    DumpPath("Export directory:", current_path);
+    DumpPath("Data directory:", obj_data_path);
+
+    log.Printf("\n");
+
+    // Skip the conversion when nothing changed since the last one
+    auto options_key = OptionsKey(options);
+    auto manifest_path = ConversionManifest::Path(obj_data_path);
+
+    PhaseTimer manifest_timer(stats, "Manifest check");
+    auto manifest = ConversionManifest::Load(manifest_path);
+    bool touched = false;
+    bool up_to_date = !options.force && manifest.UpToDate(obj_path, options_key, touched);
+
+    if (up_to_date && touched)
+        manifest.Save(manifest_path);
+
+    manifest_timer.Stop();
+
+    if (up_to_date) {
+        log.Printf("Up to date, nothing to convert.\n\n");
+        return Finish(ConvertResult::UpToDate);
+    }
+
+    // A failed conversion leaves no manifest behind
+    std::error_code manifest_ec;
+    fs::remove(manifest_path, manifest_ec);
+
+    model = ModelExport();
+    model.obj_path = obj_path;
+
+    // Parse obj, its size and time are taken first for the manifest
+    uint64_t obj_size;
+    int64_t obj_time;
+    FileSizeTime(obj_path, obj_size, obj_time);
+
+    PhaseTimer read_timer(stats, "OBJ read");
+    FileView obj_file(obj_path);
+    read_timer.Count(obj_file.View().size(), 0);
+    read_timer.Stop();
+
+    auto LoadMtl = [&](const std::string& mtl_name) {
+        fs::path mtl_path(mtl_name);
+        mtl_path = obj_dir_path / mtl_path;
+
+        DumpPath("MtlLib", mtl_path);
+        model.mtl_paths.push_back(mtl_path);
+
+        // Size and time before the read, an edit during the read then leaves a newer time on disk
+        uint64_t mtl_size;
+        int64_t mtl_time;
+        FileSizeTime(mtl_path, mtl_size, mtl_time);
+
+        FileView mtl_file(mtl_path);
+        model.mtl_stamps.push_back(StampFile(mtl_path, mtl_file.View(), mtl_size, mtl_time));
+
+        return std::string(mtl_file.View());
+    };
 
-    if (!ofs.good()) throw std::runtime_error("Cant output file");
+    auto Output = [&](const std::string& file_name, const OutputWriter& write) {
+        if (!fs::is_directory(obj_data_path))
+            fs::create_directory(obj_data_path);
+
+        fs::path path(obj_data_path / fs::path(file_name));
+        TraceScope trace("io", path);
+
+        std::ofstream ofs(path, std::ofstream::binary);
+
+        if (!ofs.good()) throw std::runtime_error("Cant output file");
+
+        write(ofs);
+        if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
 
-    // Magic number
-    ofs << "IA" << ((char)(size + '0')) << '\0';
+        model.exported_files.push_back(path);
+    };
 
-    // Reserved
-    for (size_t i = 0; i < 12; i++) ofs << '\0';
+    // Files are only kept while they are still there
+    if (cache) {
+        for (const auto& file_name : cache->Files()) {
+            if (!fs::is_regular_file(obj_data_path / fs::path(file_name))) {
+                cache->Clear();
+                break;
+            }
+        }
+    }
 
-    // Vertices block
-    PutBytes<uint32_t>(ofs, data.out_vertices.size());
+    model.materials = ConvertObj(obj_file.View(), LoadMtl, Output, options, log, obj_data_path, stats, cache);
 
-    for (const auto& vertex : data.out_vertices) {
-        for (size_t i = 0; i < size; i++)
-            PutBytes(ofs, vertex[i]);
+    if (cache) {
+        model.exported_files.clear();
+        for (const auto& file_name : cache->Files())
+            model.exported_files.push_back(obj_data_path / fs::path(file_name));
     }
 
-    // Indices block
-    PutBytes<uint32_t>(ofs, data.out_indices.size());
+    PhaseTimer hash_timer(stats, "OBJ hash");
+    model.obj_stamp = StampFile(obj_path, obj_file.View(), obj_size, obj_time);
+    hash_timer.Count(obj_file.View().size(), 0);
+    hash_timer.Stop();
 
-    for (const auto index : data.out_indices)
-        PutBytes<uint32_t>(ofs, index);
+    ExportTMDL(options, model, log, stats);
 
+    log.Printf("\nCompleted.\n\n");
+
+    return Finish(ConvertResult::Converted);
 }
 
-int main(int argc, char* argv[]) {
-    try {
-        printf("OBJ2TSR3 | OBJ to TSR3 Files Converter\n======================================\n");
+ConvertResult ConvertModel(const Options& options, const fs::path& obj_path, Log& log, ConvertStats* stats = nullptr) {
+    ModelExport model;
+    return ConvertModel(options, obj_path, log, model, stats);
+}
+
+// Statistics of a model conversion for --stats and --stats-json
+struct ModelStats {
+    fs::path obj_path;
+    std::string result; // "converted", "up_to_date" or "failed"
+    ConvertStats stats;
+};
+
+void PrintStats(const ModelStats& model, Log& log) {
+    log.Printf("Statistics of \"%s\"\n\n", model.obj_path.string().c_str());
+    model.stats.Print(log);
+    log.Printf("\n");
+}
 
-        if (argc < 2) throw std::invalid_argument("Too few arguments\nUsage: obj2tsr3 <obj file name>");
-
-        std::string obj_name = argv[1];
-        fs::path obj_path(obj_name);
-        fs::path obj_dir_path = fs::absolute(obj_path).parent_path();
-        fs::path current_path = fs::absolute(fs::current_path());
-        fs::path obj_stem = obj_path.stem();
-        fs::path obj_data_path = fs::absolute(current_path / obj_stem);
-
-        auto DumpPath = [](const std::string& desc, const fs::path& path) {
-            printf("%-20s \"%s\"\n", desc.c_str(), path.string().c_str());
-        };
-
-        DumpPath("Source file:", obj_path);
-        DumpPath("Source directory:", obj_dir_path);
-        DumpPath("Export directory:", current_path);
-        DumpPath("Data directory:", obj_data_path);
-
-        printf("\n");
-
-        std::vector<Vec<3>> positions;
-        std::vector<Vec<2>> uvs;
-        std::vector<Vec<3>> normals;
-
-        std::map<std::string, std::string> material_textures;
-        std::map<std::string, IndexedArray<8>> materials;
-        IndexedArray<8>* current_material = nullptr;
-
-        IndexedArray<3> collision_mesh;
-
-        // Parse obj
-        ParseFile(obj_path, [&](const std::string& command, std::istringstream& ls) {
-            if (command == "mtllib") {
-                std::string mtl_name;
-                std::getline(ls, mtl_name);
-
-                fs::path mtl_path(mtl_name);
-                mtl_path = obj_dir_path / mtl_path;
-
-                DumpPath("MtlLib", mtl_path);
-
-                std::string current_material_name;
-
-                // Parse mtl
-                ParseFile(mtl_path, [&](const std::string& command, std::istringstream& ls) {
-                    if (command == "newmtl")
-                        std::getline(ls, current_material_name);
-                    else if (command == "map_Kd")
-                        std::getline(ls, material_textures[current_material_name]);
-                });
-            } else if (command == "usemtl") {
-                std::string material_name;
-                std::getline(ls, material_name);
-                current_material = &materials[material_name];
-
-                printf("Compiling material \"%s\"\n", material_name.c_str());
-            } else if (command == "v") {
-                Vec<3> v;
-                ls >> v[0] >> v[1] >> v[2];
-                positions.push_back(v);
-            } else if (command == "vt") {
-                Vec<2> vt;
-                ls >> vt[0] >> vt[1];
-                uvs.push_back(vt);
-            } else if (command == "vn") {
-                Vec<3> vn;
-                ls >> vn[0] >> vn[1] >> vn[2];
-                normals.push_back(vn);
-            } else if (command == "f") {
-                if (!current_material) throw std::runtime_error("F but no material");
-
-                for (size_t i = 0; i < 3; i++) {
-                    char dummy;
-                    size_t indices[3];
-                    ls >> indices[0] >> dummy >> indices[1] >> dummy >> indices[2];
-
-                    if (indices[0] > positions.size()) throw std::out_of_range("Position out of range");
-                    if (indices[1] > uvs.size()) throw std::out_of_range("UV out of range");
-                    if (indices[2] > normals.size()) throw std::out_of_range("Normal out of range");
-
-                    auto& position = positions[indices[0] - 1];
-                    auto& uv = uvs[indices[1] - 1];
-                    auto& normal = normals[indices[2] - 1];
-
-                    current_material->OutVertex({ { position[0], position[1], position[2], uv[0], uv[1], normal[0], normal[1], normal[2] } });
-                    collision_mesh.OutVertex({ { position[0], position[1], position[2] } });
+// Writes the statistics of the conversions of a run, one entry per model
+void SaveStatsReport(const fs::path& path, const std::vector<ModelStats>& models, double seconds) {
+    nlohmann::json json;
+    json["seconds"] = seconds;
+    json["peak_memory"] = PeakMemoryUsage();
+
+    auto& json_models = json["models"] = nlohmann::json::array();
+    for (const auto& model : models) {
+        nlohmann::json json_model = model.stats.Json();
+        json_model["obj"] = model.obj_path.string();
+        json_model["result"] = model.result;
+        json_models.push_back(std::move(json_model));
+    }
+
+    std::ofstream ofs(path);
+    if (!ofs.good()) throw std::runtime_error("Cannot open statistics \""s + path.string() + "\" for output"s);
+    ofs << std::setw(4) << json;
+    if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
+}
+
+// Converts a model, then converts it again whenever its OBJ, MTL or TMDL files change, until interrupted.
+// The files are polled, a change is handled once they have been quiet for the debounce interval.
+// An OBJ change converts the model again, parsing only the changed parts of the OBJ and writing only
+// the meshes that changed. MTL and TMDL changes only export the TMDL again from the materials kept
+// from the last conversion
+void WatchModel(const Options& options, const fs::path& obj_path) {
+    const auto poll_interval = std::chrono::milliseconds(100);
+    const auto debounce_interval = std::chrono::milliseconds(300);
+
+    Options watch_options = options;
+    watch_options.force = true;
+
+    fs::path tmdl_path = fs::absolute(fs::current_path()) / fs::path(obj_path.stem().string() + ".tmdl"s);
+
+    ModelExport model;
+    ConvertCache cache;
+    Log log;
+
+    // Size and time of a watched file, zero for a missing one
+    auto Stamp = [](const fs::path& path) {
+        std::error_code ec;
+        uint64_t size = fs::file_size(path, ec);
+        if (ec) size = 0;
+
+        auto time = fs::last_write_time(path, ec);
+        return std::pair<uint64_t, int64_t>{ size, ec ? 0 : (int64_t)time.time_since_epoch().count() };
+    };
+
+    // Stamps of the obj, the TMDL and the MTLs
+    auto Stamps = [&]() {
+        std::vector<std::pair<uint64_t, int64_t>> stamps;
+
+        stamps.push_back(Stamp(obj_path));
+        stamps.push_back(Stamp(tmdl_path));
+        for (const auto& mtl_path : model.mtl_paths)
+            stamps.push_back(Stamp(mtl_path));
+
+        return stamps;
+    };
+
+    // Stamps after an update, from the obj stamp taken before it and the MTL stamps taken
+    // before they were read. Only the TMDL the update wrote itself is stamped afresh, so
+    // inputs saved while the update ran are still seen as changed
+    auto UpdatedStamps = [&](const std::pair<uint64_t, int64_t>& obj_stamp) {
+        if (model.mtl_stamps.size() != model.mtl_paths.size()) {
+            // An MTL failed to read, it is watched from now on
+            auto stamps = Stamps();
+            stamps[0] = obj_stamp;
+            return stamps;
+        }
+
+        std::vector<std::pair<uint64_t, int64_t>> stamps;
+
+        stamps.push_back(obj_stamp);
+        stamps.push_back(Stamp(tmdl_path));
+        for (const auto& mtl_stamp : model.mtl_stamps)
+            stamps.push_back({ mtl_stamp.size, mtl_stamp.time });
+
+        return stamps;
+    };
+
+    // Errors are reported and the files watched for the next change
+    bool converted = false;
+
+    auto Update = [&](bool obj_changed) {
+        auto start = std::chrono::steady_clock::now();
+
+        ModelStats model_stats;
+        model_stats.obj_path = obj_path;
+        model_stats.result = "converted";
+        ConvertStats* stats = options.CollectStats() ? &model_stats.stats : nullptr;
+
+        try {
+            if (obj_changed || !converted) {
+                converted = false;
+                ConvertModel(watch_options, obj_path, log, model, stats, &cache);
+                converted = true;
+            } else {
+                log.Printf("Exporting materials of \"%s\"\n", obj_path.string().c_str());
+
+                model.materials.material_textures.clear();
+                model.mtl_stamps.clear();
+
+                for (const auto& mtl_path : model.mtl_paths) {
+                    PhaseTimer timer(stats, "MTL parse");
+
+                    uint64_t mtl_size;
+                    int64_t mtl_time;
+                    FileSizeTime(mtl_path, mtl_size, mtl_time);
+
+                    FileView mtl_file(mtl_path);
+                    ParseMtl(mtl_file.View(), model.materials.material_textures);
+                    model.mtl_stamps.push_back(StampFile(mtl_path, mtl_file.View(), mtl_size, mtl_time));
+
+                    timer.Count(mtl_file.View().size(), 0);
                 }
+
+                ExportTMDL(options, model, log, stats);
             }
-        });
 
-        printf("\nExporting...\n\n");
+            log.Printf("Updated in %.3f s\n\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        } catch (const std::exception& ex) {
+            model_stats.result = "failed";
+            log.Printf("Error: %s\n\n", ex.what());
+        }
 
-        if (!fs::is_directory(obj_data_path))
-            fs::create_directory(obj_data_path);
+        // Reports of a failed update too, an unwritable report file must not end the watch either
+        try {
+            if (stats) {
+                stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                stats->peak_memory = PeakMemoryUsage();
+
+                if (options.stats) PrintStats(model_stats, log);
+                if (!options.stats_json.empty()) SaveStatsReport(options.stats_json, { model_stats }, stats->seconds);
+            }
+
+            // Appends the events of the update to the trace file
+            if (!options.trace_name.empty())
+                Trace::Save(options.trace_name);
+        } catch (const std::exception& ex) {
+            log.Printf("Error: %s\n\n", ex.what());
+        }
+
+        log.Printf("Watching for changes...\n\n");
+        fflush(stdout);
+    };
 
-        // Graphics export
+    auto initial = Stamp(obj_path);
+    Update(true);
+    auto stamps = UpdatedStamps(initial);
 
-        for (const auto& material : materials) {
-            fs::path material_ia8(obj_data_path / fs::path(material.first + ".ia8"));
-            DumpPath("Export: ", material_ia8);
+    for (;;) {
+        std::this_thread::sleep_for(poll_interval);
 
-            size_t num_vertices = material.second.out_vertices.size();
-            size_t num_indices = material.second.out_indices.size();
-            printf("%u vertices, %u indices (each vertex used %.1f times in avg)\n\n", num_vertices, num_indices, (float)num_indices / (float)num_vertices);
+        auto current = Stamps();
+        if (current == stamps) continue;
 
-            CreateIA<8>(material_ia8, material.second);
+        // Wait for a burst of writes to end
+        for (;;) {
+            std::this_thread::sleep_for(debounce_interval);
+
+            auto settled = Stamps();
+            if (settled == current) break;
+            current = settled;
         }
 
-        // Physics export
+        Update(current[0] != stamps[0]);
+        stamps = UpdatedStamps(current[0]);
+    }
+}
+
+// OBJ files of the positional arguments, then of the batch list. Batch list lines are
+// paths relative to the list file, empty lines and lines starting with # are skipped
+std::vector<fs::path> ModelPaths(const Options& options) {
+    std::vector<fs::path> obj_paths(options.obj_names.begin(), options.obj_names.end());
+
+    if (!options.batch_name.empty()) {
+        fs::path batch_path(options.batch_name);
+        fs::path batch_dir_path = fs::absolute(batch_path).parent_path();
+
+        FileView batch_file(batch_path);
 
-        fs::path ia3(obj_data_path / fs::path("collision.ia3"));
-        DumpPath("Collision: ", ia3);
+        ParseLines(batch_file.View(), [&](std::string_view command, LineCursor& ls) {
+            // The whole line is the path, paths may contain spaces
+            std::string_view rest = ls.Rest();
+            std::string_view line(command.data(), rest.data() + rest.size() - command.data());
+            while (!line.empty() && (line.back() == ' ' || line.back() == '\t')) line.remove_suffix(1);
 
-        size_t num_vertices = collision_mesh.out_vertices.size();
-        size_t num_indices = collision_mesh.out_indices.size();
-        printf("%u vertices, %u indices (each vertex used %.1f times in avg)\n\n", num_vertices, num_indices, (float)num_indices / (float)num_vertices);
+            obj_paths.push_back(batch_dir_path / fs::path(std::string(line)));
+        });
+    }
+
+    if (obj_paths.empty()) throw std::invalid_argument("No OBJ files in batch list \""s + options.batch_name + "\""s);
 
-        CreateIA<3>(ia3, collision_mesh);
+    return obj_paths;
+}
 
-        // TMDL export
+// Converts every model on a pool of options.threads threads, each model on a single thread.
+// Logs are printed whole as models finish, a failed model does not stop the others.
+// Returns false when a model failed
+bool ConvertBatch(const Options& options, const std::vector<fs::path>& obj_paths) {
+    // Models with the same name would export to the same files
+    std::map<std::string, fs::path> model_names;
+    for (const auto& obj_path : obj_paths) {
+        auto model = model_names.emplace(obj_path.stem().string(), obj_path);
+        if (!model.second)
+            throw std::invalid_argument("Models \""s + model.first->second.string() + "\" and \""s + obj_path.string() + "\" have the same name"s);
+    }
 
-        printf("\nExporting TMDL...\n\n");
+    // Largest models first, so that small ones fill the gaps at the end
+    std::vector<uint64_t> sizes(obj_paths.size());
+    for (size_t i = 0; i < obj_paths.size(); i++) {
+        std::error_code ec;
+        sizes[i] = fs::file_size(obj_paths[i], ec);
+        if (ec) sizes[i] = 0;
+    }
 
-        nlohmann::json tmdl;
+    std::vector<size_t> order(obj_paths.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
 
-        std::string model_name = obj_stem.string();
-        auto tmdl_path = current_path / fs::path(model_name + ".tmdl"s);
+    Options model_options = options;
+    model_options.threads = 1;
 
-        // Read current tmdl
-        if (fs::is_regular_file(tmdl_path)) {
-            std::ifstream tmdl_i(tmdl_path);
-            if (!tmdl_i.good()) throw std::runtime_error("Cannot open TMDL \""s + tmdl_path.string() + "\""s);
-            tmdl_i >> tmdl;
-            tmdl_i.close();
+    struct Outcome {
+        ConvertResult result = ConvertResult::Converted;
+        std::string error;
+    };
+
+    std::vector<Outcome> outcomes(obj_paths.size());
+    std::vector<ModelStats> model_stats(obj_paths.size());
+    std::mutex output_mutex;
+
+    auto start = std::chrono::steady_clock::now();
+
+    ParallelFor(order.size(), options.threads, [&](size_t i) {
+        size_t model = order[i];
+        Log log(true);
+
+        auto& stats = model_stats[model];
+        stats.obj_path = obj_paths[model];
+
+        try {
+            outcomes[model].result = ConvertModel(model_options, obj_paths[model], log, options.CollectStats() ? &stats.stats : nullptr);
+            stats.result = outcomes[model].result == ConvertResult::UpToDate ? "up_to_date" : "converted";
+        } catch (const std::exception& ex) {
+            outcomes[model].error = ex.what();
+            stats.result = "failed";
+            log.Printf("Error: %s\n\n", ex.what());
         }
 
-        auto& tmdl_draw = tmdl["draw"];
-        for (const auto& material : material_textures) {
-            auto& tmdl_material = tmdl_draw[material.first];
-            tmdl_material["mesh"] = model_name + "/"s + material.first + ".ia8"s;
-            tmdl_material["texture"] = std::regex_replace(material.second, std::regex("\\\\\\\\"), "/");
+        if (options.stats) PrintStats(stats, log);
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        fwrite(log.Text().data(), 1, log.Text().size(), stdout);
+        fflush(stdout);
+    });
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t num_converted = 0, num_up_to_date = 0, num_failed = 0;
+
+    printf("Batch summary\n=============\n");
+
+    for (size_t i = 0; i < obj_paths.size(); i++) {
+        if (!outcomes[i].error.empty()) {
+            printf("%-20s \"%s\": %s\n", "Failed:", obj_paths[i].string().c_str(), outcomes[i].error.c_str());
+            num_failed++;
+        } else if (outcomes[i].result == ConvertResult::UpToDate) {
+            num_up_to_date++;
+        } else {
+            num_converted++;
         }
+    }
+
+    printf("%zu models: %zu converted, %zu up to date, %zu failed (%.2f s)\n\n", obj_paths.size(), num_converted, num_up_to_date, num_failed, seconds);
+
+    if (!options.stats_json.empty())
+        SaveStatsReport(options.stats_json, model_stats, seconds);
+
+    return num_failed == 0;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        printf("OBJ2TSR3 | OBJ to TSR3 Files Converter\n======================================\n");
+
+        Options options = ParseOptions(argc, argv);
+
+        if (!options.trace_name.empty())
+            Trace::Start();
 
-        if (!tmdl.contains("name"))
-            tmdl["name"] = model_name;
+        // Archive extraction, every section is written relative to the current directory
+        if (!options.unpack_name.empty()) {
+            Archive archive(options.unpack_name);
 
-        if (!tmdl.contains("collision"))
-            tmdl["collision"] = model_name + "/collision.ia3"s;
+            // Every name is checked before anything is written, a hostile archive extracts nothing
+            std::vector<fs::path> section_paths;
+            for (const auto& section : archive.Sections())
+                section_paths.push_back(ArchiveEntryPath(section.first));
 
-        if (!tmdl.contains("mass"))
-            tmdl["mass"] = 0.0f;
+            auto section_path = section_paths.begin();
 
-        std::ofstream tmdl_o(tmdl_path);
-        if (!tmdl_o.good()) throw std::runtime_error("Cannot open TMDL \""s + tmdl_path.string() + "\" for output"s);
-        tmdl_o << std::setw(4) << tmdl;
-        tmdl_o.close();
+            for (const auto& section : archive.Sections()) {
+                printf("%-20s \"%s\" (%zu bytes)\n", "Extract:", section.first.c_str(), section.second.size());
 
-        printf("\nCompleted.\n\n");
+                const fs::path& path = *section_path++;
+                if (path.has_parent_path()) fs::create_directories(path.parent_path());
 
-    } catch (std::exception ex) {
+                std::ofstream ofs(path, std::ofstream::binary);
+                if (!ofs.good()) throw std::runtime_error("Cannot open \""s + path.string() + "\" for output"s);
+                ofs.write(section.second.data(), section.second.size());
+                if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
+            }
+
+            printf("\nCompleted.\n\n");
+            return EXIT_SUCCESS;
+        }
+
+        std::vector<fs::path> obj_paths = ModelPaths(options);
+        bool succeeded = true;
+
+        if (options.watch) {
+            if (!options.batch_name.empty() || obj_paths.size() != 1) throw std::invalid_argument("--watch takes a single OBJ file");
+            WatchModel(options, obj_paths[0]);
+        } else if (options.batch_name.empty() && obj_paths.size() == 1) {
+            Log log;
+
+            if (!options.CollectStats()) {
+                ConvertModel(options, obj_paths[0], log);
+            } else {
+                ModelStats model_stats;
+                model_stats.obj_path = obj_paths[0];
+                auto result = ConvertModel(options, obj_paths[0], log, &model_stats.stats);
+                model_stats.result = result == ConvertResult::UpToDate ? "up_to_date" : "converted";
+
+                if (options.stats) PrintStats(model_stats, log);
+                if (!options.stats_json.empty()) SaveStatsReport(options.stats_json, { model_stats }, model_stats.stats.seconds);
+            }
+        } else {
+            succeeded = ConvertBatch(options, obj_paths);
+        }
+
+        if (!options.trace_name.empty())
+            Trace::Save(options.trace_name);
+
+        if (!succeeded)
+            return EXIT_FAILURE;
+
+    } catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << "\n";
         return EXIT_FAILURE;
     }
@@ -288,3 +883,4 @@ int main(int argc, char* argv[]) {
     return EXIT_SUCCESS;
 
 }
+
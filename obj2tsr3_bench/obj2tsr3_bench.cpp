@@ -0,0 +1,686 @@
+#include "libobj2tsr3.h"
+#include "libobj2tsr3_detail.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+using namespace obj2tsr3;
+using std::literals::string_literals::operator""s;
+
+// Deterministic random numbers (splitmix64), the same sequence on every platform and
+// standard library so that the generated corpus never changes between runs
+class Random {
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [min, max)
+    float Uniform(float min, float max) {
+        return min + (max - min) * (float)(Next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    // Uniform in [0, count)
+    size_t Index(size_t count) {
+        return (size_t)(Next() % count);
+    }
+};
+
+// Synthetic model kinds
+enum class ModelKind {
+    Grid,   // Flat grid, one normal, every position shared by up to 6 triangles
+    Sphere, // UV sphere with smooth normals and a UV seam
+    Scan,   // Noisy sphere with faces in random order, like a scanned mesh
+    Scene,  // Many small objects, each with its own material
+};
+
+const char* ModelKindName(ModelKind kind) {
+    switch (kind) {
+    case ModelKind::Grid: return "grid";
+    case ModelKind::Sphere: return "sphere";
+    case ModelKind::Scan: return "scan";
+    case ModelKind::Scene: return "scene";
+    }
+
+    return "";
+}
+
+ModelKind ParseModelKind(const std::string& name) {
+    for (auto kind : { ModelKind::Grid, ModelKind::Sphere, ModelKind::Scan, ModelKind::Scene })
+        if (name == ModelKindName(kind)) return kind;
+
+    throw std::invalid_argument("Unknown model kind \""s + name + "\""s);
+}
+
+// OBJ and MTL text of a synthetic model
+struct SyntheticModel {
+    std::string name;
+    std::string obj;
+    std::string mtl;
+    size_t triangles = 0;
+};
+
+// Appends OBJ lines to a text
+class ObjBuilder {
+    std::string& text;
+    char line[128];
+
+public:
+    explicit ObjBuilder(std::string& text) : text(text) {}
+
+    void Position(float x, float y, float z) {
+        text.append(line, (size_t)snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", x, y, z));
+    }
+
+    void UV(float u, float v) {
+        text.append(line, (size_t)snprintf(line, sizeof(line), "vt %.6f %.6f\n", u, v));
+    }
+
+    void Normal(float x, float y, float z) {
+        text.append(line, (size_t)snprintf(line, sizeof(line), "vn %.6f %.6f %.6f\n", x, y, z));
+    }
+
+    // Triangle of 1-based v/vt/vn corners
+    void Face(const std::array<size_t, 9>& corners) {
+        text.append(line, (size_t)snprintf(line, sizeof(line), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+            corners[0], corners[1], corners[2], corners[3], corners[4], corners[5], corners[6], corners[7], corners[8]));
+    }
+
+    void Command(const std::string& command, const std::string& name) {
+        text += command + " "s + name + "\n"s;
+    }
+};
+
+// Attribute counts of an OBJ built so far, faces of a part index from them
+struct ObjCounts {
+    size_t positions = 0;
+    size_t uvs = 0;
+    size_t normals = 0;
+};
+
+// Grid of columns x rows quads over [x0, x0 + size] x [z0, z0 + size] at height y
+size_t AddGrid(ObjBuilder& obj, ObjCounts& counts, size_t columns, size_t rows, float x0, float z0, float y, float size) {
+    for (size_t r = 0; r <= rows; r++) {
+        for (size_t c = 0; c <= columns; c++) {
+            float u = (float)c / (float)columns, v = (float)r / (float)rows;
+            obj.Position(x0 + u * size, y, z0 + v * size);
+            obj.UV(u, v);
+        }
+    }
+
+    obj.Normal(0.0f, 1.0f, 0.0f);
+
+    size_t normal = counts.normals + 1;
+
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t c = 0; c < columns; c++) {
+            size_t a = counts.positions + r * (columns + 1) + c + 1;
+            size_t b = a + 1, d = a + columns + 1, e = d + 1;
+            size_t ta = a - counts.positions + counts.uvs, tb = b - counts.positions + counts.uvs;
+            size_t td = d - counts.positions + counts.uvs, te = e - counts.positions + counts.uvs;
+
+            obj.Face({ a, ta, normal, d, td, normal, b, tb, normal });
+            obj.Face({ b, tb, normal, d, td, normal, e, te, normal });
+        }
+    }
+
+    counts.positions += (rows + 1) * (columns + 1);
+    counts.uvs += (rows + 1) * (columns + 1);
+    counts.normals += 1;
+
+    return rows * columns * 2;
+}
+
+// UV sphere of roughly the given triangle count, noise displaces positions and normals
+// radially, shuffled faces are written in random order
+size_t AddSphere(ObjBuilder& obj, ObjCounts& counts, size_t triangles, float cx, float cy, float cz, float radius, float noise, bool shuffle, Random& random) {
+    const float pi = 3.14159265358979f;
+
+    size_t rings = std::max<size_t>(2, (size_t)std::sqrt((double)triangles / 4.0));
+    size_t segments = std::max<size_t>(3, rings * 2);
+
+    for (size_t r = 0; r <= rings; r++) {
+        for (size_t s = 0; s <= segments; s++) {
+            float u = (float)s / (float)segments, v = (float)r / (float)rings;
+            float theta = v * pi, phi = u * 2.0f * pi;
+            float nx = std::sin(theta) * std::cos(phi), ny = std::cos(theta), nz = std::sin(theta) * std::sin(phi);
+
+            float scale = radius * (1.0f + (noise > 0.0f ? random.Uniform(-noise, noise) : 0.0f));
+            obj.Position(cx + nx * scale, cy + ny * scale, cz + nz * scale);
+            obj.UV(u, v);
+
+            if (noise > 0.0f) {
+                nx += random.Uniform(-noise, noise);
+                ny += random.Uniform(-noise, noise);
+                nz += random.Uniform(-noise, noise);
+                float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+                nx /= length, ny /= length, nz /= length;
+            }
+
+            obj.Normal(nx, ny, nz);
+        }
+    }
+
+    std::vector<std::array<size_t, 9>> faces;
+    faces.reserve(rings * segments * 2);
+
+    for (size_t r = 0; r < rings; r++) {
+        for (size_t s = 0; s < segments; s++) {
+            size_t a = r * (segments + 1) + s, b = a + 1, d = a + segments + 1, e = d + 1;
+
+            auto Corner = [&](size_t vertex, std::array<size_t, 9>& face, size_t i) {
+                face[i * 3 + 0] = counts.positions + vertex + 1;
+                face[i * 3 + 1] = counts.uvs + vertex + 1;
+                face[i * 3 + 2] = counts.normals + vertex + 1;
+            };
+
+            std::array<size_t, 9> face;
+            Corner(a, face, 0), Corner(b, face, 1), Corner(d, face, 2);
+            faces.push_back(face);
+            Corner(b, face, 0), Corner(e, face, 1), Corner(d, face, 2);
+            faces.push_back(face);
+        }
+    }
+
+    if (shuffle) {
+        for (size_t i = faces.size(); i > 1; i--)
+            std::swap(faces[i - 1], faces[random.Index(i)]);
+    }
+
+    for (const auto& face : faces)
+        obj.Face(face);
+
+    size_t num_vertices = (rings + 1) * (segments + 1);
+    counts.positions += num_vertices;
+    counts.uvs += num_vertices;
+    counts.normals += num_vertices;
+
+    return faces.size();
+}
+
+// Generates a model of roughly the given triangle count, the same seed always gives the same text
+SyntheticModel GenerateModel(ModelKind kind, size_t triangles, uint64_t seed) {
+    SyntheticModel model;
+    model.name = ModelKindName(kind) + "_"s + std::to_string(triangles);
+
+    Random random(seed);
+    ObjBuilder obj(model.obj);
+    ObjCounts counts;
+
+    std::vector<std::string> materials;
+
+    if (kind == ModelKind::Scene) {
+        // One object per 2000 triangles, from 4 to 1024 materials
+        size_t num_objects = std::min<size_t>(1024, std::max<size_t>(4, triangles / 2000));
+        size_t object_triangles = std::max<size_t>(8, triangles / num_objects);
+        size_t side = (size_t)std::ceil(std::sqrt((double)num_objects));
+
+        obj.Command("mtllib", model.name + ".mtl"s);
+
+        for (size_t i = 0; i < num_objects; i++) {
+            materials.push_back("material" + std::to_string(i));
+            obj.Command("usemtl", materials.back());
+
+            float x = (float)(i % side) * 3.0f, z = (float)(i / side) * 3.0f;
+
+            if (i % 2 == 0) {
+                size_t columns = std::max<size_t>(1, (size_t)std::sqrt((double)object_triangles / 2.0));
+                model.triangles += AddGrid(obj, counts, columns, columns, x, z, 0.0f, 2.0f);
+            } else {
+                model.triangles += AddSphere(obj, counts, object_triangles, x + 1.0f, 1.0f, z + 1.0f, 1.0f, 0.0f, false, random);
+            }
+        }
+    } else {
+        materials.push_back("material");
+
+        obj.Command("mtllib", model.name + ".mtl"s);
+        obj.Command("usemtl", materials.back());
+
+        if (kind == ModelKind::Grid) {
+            size_t columns = std::max<size_t>(1, (size_t)std::sqrt((double)triangles / 2.0));
+            model.triangles = AddGrid(obj, counts, columns, columns, -1.0f, -1.0f, 0.0f, 2.0f);
+        } else if (kind == ModelKind::Sphere) {
+            model.triangles = AddSphere(obj, counts, triangles, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, false, random);
+        } else {
+            model.triangles = AddSphere(obj, counts, triangles, 0.0f, 0.0f, 0.0f, 1.0f, 0.01f, true, random);
+        }
+    }
+
+    for (const auto& material : materials)
+        model.mtl += "newmtl "s + material + "\nmap_Kd textures\\\\"s + material + ".dds\n\n"s;
+
+    return model;
+}
+
+// Corners of the faces of an OBJ text as IA8 vertices, the input of the dedup benchmark
+std::vector<Vec<8>> ObjCorners(std::string_view obj) {
+    std::vector<Vec<3>> positions;
+    std::vector<Vec<2>> uvs;
+    std::vector<Vec<3>> normals;
+    std::vector<Vec<8>> corners;
+
+    ParseLines(obj, [&](std::string_view command, LineCursor& ls) {
+        if (command == "v") {
+            positions.push_back({ { ls.Float(), ls.Float(), ls.Float() } });
+        } else if (command == "vt") {
+            uvs.push_back({ { ls.Float(), ls.Float() } });
+        } else if (command == "vn") {
+            normals.push_back({ { ls.Float(), ls.Float(), ls.Float() } });
+        } else if (command == "f") {
+            for (size_t i = 0; i < 3; i++) {
+                size_t p = ls.Index() - 1;
+                ls.Char();
+                size_t t = ls.Index() - 1;
+                ls.Char();
+                size_t n = ls.Index() - 1;
+
+                corners.push_back({ { positions[p][0], positions[p][1], positions[p][2], uvs[t][0], uvs[t][1], normals[n][0], normals[n][1], normals[n][2] } });
+            }
+        }
+    });
+
+    return corners;
+}
+
+// Benchmark options
+struct BenchOptions {
+    std::vector<ModelKind> kinds = { ModelKind::Grid, ModelKind::Sphere, ModelKind::Scan, ModelKind::Scene };
+    std::vector<size_t> sizes = { 1000, 100000, 1000000 };
+    size_t repeat = 5;
+    unsigned threads = 0;
+    uint64_t seed = 1;
+    std::string json_name;     // Report file
+    std::string generate_name; // Directory to write the corpus to instead of benchmarking
+};
+
+// Times of the runs of a benchmark, the minimum and median are reported
+struct BenchResult {
+    std::string model;
+    std::string name;
+    std::vector<double> seconds;
+    uint64_t bytes = 0;   // Per run
+    uint64_t records = 0; // Per run
+    std::string unit;     // What records count
+
+    double Min() const {
+        return *std::min_element(seconds.begin(), seconds.end());
+    }
+
+    double Median() const {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+// Runs a benchmark options.repeat times after a warm up run
+template<typename Run>
+BenchResult Bench(const BenchOptions& options, const std::string& model, const std::string& name, Run run) {
+    BenchResult result;
+    result.model = model;
+    result.name = name;
+
+    run(result);
+
+    for (size_t i = 0; i < options.repeat; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run(result);
+        result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    printf("%-20s %-16s %10.3f %10.3f %10.1f %14.0f %s/s\n", model.c_str(), name.c_str(), result.Min() * 1000.0, result.Median() * 1000.0,
+        (double)result.bytes / result.Min() / (1024.0 * 1024.0), (double)result.records / result.Min(), result.unit.c_str());
+    fflush(stdout);
+
+    return result;
+}
+
+// Benchmarks one model: parsing, corner dedup, IA8 and IA3 writing, simplification, the whole conversion and collision queries
+void BenchModel(const BenchOptions& options, const SyntheticModel& model, const fs::path& work_path, std::vector<BenchResult>& results) {
+    fs::path obj_path = work_path / fs::path(model.name + ".obj"s);
+    {
+        std::ofstream ofs(obj_path, std::ofstream::binary);
+        ofs.write(model.obj.data(), model.obj.size());
+        if (!ofs.good()) throw std::runtime_error("Cannot write \""s + obj_path.string() + "\""s);
+    }
+
+    // ParseFile, every line parsed the way the converter does
+    results.push_back(Bench(options, model.name, "ParseFile", [&](BenchResult& result) {
+        size_t lines = 0;
+        float sum = 0.0f;
+
+        ParseFile(obj_path, [&](std::string_view command, LineCursor& ls) {
+            if (command == "v" || command == "vn") {
+                sum += ls.Float() + ls.Float() + ls.Float();
+            } else if (command == "vt") {
+                sum += ls.Float() + ls.Float();
+            } else if (command == "f") {
+                for (size_t i = 0; i < 9; i++) {
+                    sum += (float)ls.Index();
+                    ls.Char();
+                }
+            }
+
+            lines++;
+        });
+
+        if (std::isnan(sum)) throw std::runtime_error("Parse failed");
+
+        result.bytes = model.obj.size();
+        result.records = lines;
+        result.unit = "lines";
+    }));
+
+    // OutVertex, float dedup of every face corner
+    std::vector<Vec<8>> corners = ObjCorners(model.obj);
+    IndexedArray<8> mesh;
+
+    results.push_back(Bench(options, model.name, "OutVertex", [&](BenchResult& result) {
+        mesh = IndexedArray<8>();
+        mesh.out_indices.reserve(corners.size());
+
+        for (const auto& corner : corners)
+            mesh.OutVertex(corner);
+
+        result.bytes = corners.size() * sizeof(Vec<8>);
+        result.records = corners.size();
+        result.unit = "corners";
+    }));
+
+    corners = std::vector<Vec<8>>();
+
+    // CreateIA of the deduplicated mesh
+    fs::path ia_path = work_path / fs::path(model.name + ".ia8"s);
+
+    results.push_back(Bench(options, model.name, "CreateIA", [&](BenchResult& result) {
+        CreateIA<8>(ia_path, mesh);
+
+        result.bytes = fs::file_size(ia_path);
+        result.records = mesh.out_vertices.size() + mesh.out_indices.size();
+        result.unit = "elements";
+    }));
+
+    fs::remove(ia_path);
+
+    // Welded positions, the collision mesh of the model
+    IndexedArray<3> positions;
+    positions.out_indices.reserve(mesh.out_indices.size());
+
+    for (const auto index : mesh.out_indices) {
+        const auto& vertex = mesh.out_vertices[index];
+        positions.OutVertex(std::array<float, 3>{ vertex[0], vertex[1], vertex[2] });
+    }
+
+    mesh = IndexedArray<8>();
+
+    // CreateIA of the positions, as collision.ia3 is written
+    fs::path ia3_path = work_path / fs::path(model.name + ".ia3"s);
+
+    results.push_back(Bench(options, model.name, "CreateIA3", [&](BenchResult& result) {
+        CreateIA<3>(ia3_path, positions);
+
+        result.bytes = fs::file_size(ia3_path);
+        result.records = positions.out_vertices.size() + positions.out_indices.size();
+        result.unit = "elements";
+    }));
+
+    fs::remove(ia3_path);
+
+    // Simplification of the collision mesh to a tenth of its triangles
+    results.push_back(Bench(options, model.name, "Simplify", [&](BenchResult& result) {
+        detail::Simplifier<3> simplifier(positions);
+        simplifier.Simplify(positions.out_indices.size() / 30);
+
+        result.records = positions.out_indices.size() / 3;
+        result.unit = "triangles";
+    }));
+
+    positions = IndexedArray<3>();
+
+    // End to end conversion in memory, with a collision BVH
+    ConvertOptions convert_options;
+    convert_options.threads = options.threads;
+    convert_options.build_bvh = true;
+
+    auto LoadMtl = [&](const std::string&) { return model.mtl; };
+    ConvertedModel converted;
+
+    results.push_back(Bench(options, model.name, "ConvertObj", [&](BenchResult& result) {
+        Log log(true);
+        converted = ConvertObjToMemory(model.obj, LoadMtl, model.name, convert_options, log);
+
+        result.bytes = model.obj.size();
+        result.records = model.triangles;
+        result.unit = "triangles";
+    }));
+
+    // Collision queries against the BVH of the conversion, loaded as a runtime would
+    fs::path bvh_path = work_path / fs::path(model.name + ".bvh"s);
+    {
+        const std::string& data = converted.files.at("collision.bvh");
+        std::ofstream ofs(bvh_path, std::ofstream::binary);
+        ofs.write(data.data(), data.size());
+        if (!ofs.good()) throw std::runtime_error("Cannot write \""s + bvh_path.string() + "\""s);
+    }
+
+    BVH bvh = LoadBVH(bvh_path);
+    fs::remove(bvh_path);
+    converted = ConvertedModel();
+
+    // Rays from random points in the bounds towards random directions
+    const size_t num_queries = 100000;
+    const BVHNode& root = bvh.nodes[0];
+
+    Random random(options.seed);
+    std::vector<std::array<float, 6>> rays(num_queries);
+
+    for (auto& ray : rays) {
+        float direction[3], length = 0.0f;
+
+        for (size_t i = 0; i < 3; i++) {
+            ray[i] = random.Uniform(root.min[i], root.max[i]);
+            direction[i] = random.Uniform(-1.0f, 1.0f);
+            length += direction[i] * direction[i];
+        }
+
+        length = std::max(std::sqrt(length), 1e-6f);
+        for (size_t i = 0; i < 3; i++) ray[3 + i] = direction[i] / length;
+    }
+
+    results.push_back(Bench(options, model.name, "RayQuery", [&](BenchResult& result) {
+        for (const auto& ray : rays)
+            RayQuery(bvh, &ray[0], &ray[3], std::numeric_limits<float>::infinity());
+
+        result.records = rays.size();
+        result.unit = "rays";
+    }));
+
+    // Boxes of 1% of the bounds around the ray origins
+    std::vector<uint32_t> triangles;
+
+    results.push_back(Bench(options, model.name, "AabbQuery", [&](BenchResult& result) {
+        for (const auto& ray : rays) {
+            float min[3], max[3];
+
+            for (size_t i = 0; i < 3; i++) {
+                float extent = (root.max[i] - root.min[i]) * 0.005f;
+                min[i] = ray[i] - extent;
+                max[i] = ray[i] + extent;
+            }
+
+            triangles.clear();
+            AabbQuery(bvh, min, max, triangles);
+        }
+
+        result.records = rays.size();
+        result.unit = "queries";
+    }));
+
+    fs::remove(obj_path);
+}
+
+std::vector<std::string> SplitList(const std::string& list) {
+    std::vector<std::string> items;
+
+    for (size_t begin = 0; begin <= list.size(); ) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) end = list.size();
+
+        if (end > begin) items.push_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+
+    return items;
+}
+
+BenchOptions ParseOptions(int argc, char* argv[]) {
+    const char* usage =
+        "Usage: obj2tsr3_bench [options]\n"
+        "  --kinds <list>         Comma separated model kinds: grid, sphere, scan, scene (default: all)\n"
+        "  --sizes <list>         Comma separated triangle counts (default: 1000,100000,1000000)\n"
+        "  --preset <name>        Sizes of a preset: default, or large for 1000 to 50M triangles\n"
+        "                         (1000,100000,1000000,10000000,50000000), about 24 GiB of memory at 50M\n"
+        "  --repeat <count>       Timed runs of every benchmark after a warm up run (default: 5)\n"
+        "  --threads <count>      OBJ parser threads of the conversion benchmark (default: all)\n"
+        "  --seed <value>         Corpus seed, the same seed always generates the same models (default: 1)\n"
+        "  --json <file>          Also write the results to a JSON report\n"
+        "  --generate <dir>       Write the corpus OBJ and MTL files to a directory instead of benchmarking";
+
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--kinds" && i + 1 < argc) {
+            options.kinds.clear();
+            for (const auto& kind : SplitList(argv[++i]))
+                options.kinds.push_back(ParseModelKind(kind));
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            options.sizes.clear();
+            for (const auto& size : SplitList(argv[++i]))
+                options.sizes.push_back((size_t)std::stoull(size));
+        } else if (arg == "--preset" && i + 1 < argc) {
+            std::string preset = argv[++i];
+
+            if (preset == "default")
+                options.sizes = BenchOptions().sizes;
+            else if (preset == "large")
+                options.sizes = { 1000, 100000, 1000000, 10000000, 50000000 };
+            else
+                throw std::invalid_argument("Unknown preset \""s + preset + "\"\n"s + usage);
+        } else if (arg == "--repeat" && i + 1 < argc)
+            options.repeat = std::max<size_t>(1, (size_t)std::stoull(argv[++i]));
+        else if (arg == "--threads" && i + 1 < argc)
+            options.threads = (unsigned)std::stoul(argv[++i]);
+        else if (arg == "--seed" && i + 1 < argc)
+            options.seed = std::stoull(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc)
+            options.json_name = argv[++i];
+        else if (arg == "--generate" && i + 1 < argc)
+            options.generate_name = argv[++i];
+        else
+            throw std::invalid_argument("Unknown option \""s + arg + "\"\n"s + usage);
+    }
+
+    if (options.kinds.empty() || options.sizes.empty()) throw std::invalid_argument("No models to benchmark\n"s + usage);
+
+    return options;
+}
+
+void SaveReport(const fs::path& path, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    nlohmann::json json;
+    json["repeat"] = options.repeat;
+    json["threads"] = options.threads;
+    json["seed"] = options.seed;
+
+    auto& json_results = json["results"] = nlohmann::json::array();
+    for (const auto& result : results) {
+        json_results.push_back({
+            { "model", result.model },
+            { "benchmark", result.name },
+            { "seconds", result.seconds },
+            { "min_seconds", result.Min() },
+            { "median_seconds", result.Median() },
+            { "bytes", result.bytes },
+            { "records", result.records },
+            { "unit", result.unit },
+        });
+    }
+
+    std::ofstream ofs(path);
+    if (!ofs.good()) throw std::runtime_error("Cannot open report \""s + path.string() + "\" for output"s);
+    ofs << std::setw(4) << json;
+    if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        printf("OBJ2TSR3 | Benchmarks\n=====================\n");
+
+        BenchOptions options = ParseOptions(argc, argv);
+
+        // Corpus export, the files every benchmark run generates in memory
+        if (!options.generate_name.empty()) {
+            fs::path corpus_path(options.generate_name);
+            fs::create_directories(corpus_path);
+
+            for (auto kind : options.kinds) {
+                for (auto size : options.sizes) {
+                    SyntheticModel model = GenerateModel(kind, size, options.seed);
+
+                    for (const auto& file : { std::make_pair(".obj"s, &model.obj), std::make_pair(".mtl"s, &model.mtl) }) {
+                        fs::path path = corpus_path / fs::path(model.name + file.first);
+                        printf("%-20s \"%s\" (%zu triangles)\n", "Generate:", path.string().c_str(), model.triangles);
+
+                        std::ofstream ofs(path, std::ofstream::binary);
+                        ofs.write(file.second->data(), file.second->size());
+                        if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
+                    }
+                }
+            }
+
+            printf("\nCompleted.\n\n");
+            return EXIT_SUCCESS;
+        }
+
+        fs::path work_path = fs::temp_directory_path() / fs::path("obj2tsr3_bench");
+        fs::create_directories(work_path);
+
+        printf("%-20s %-16s %10s %10s %10s %14s\n", "Model", "Benchmark", "Min (ms)", "Med (ms)", "MiB/s", "Throughput");
+
+        std::vector<BenchResult> results;
+
+        for (auto kind : options.kinds) {
+            for (auto size : options.sizes) {
+                SyntheticModel model = GenerateModel(kind, size, options.seed);
+                BenchModel(options, model, work_path, results);
+            }
+        }
+
+        std::error_code ec;
+        fs::remove(work_path, ec);
+
+        if (!options.json_name.empty())
+            SaveReport(options.json_name, options, results);
+
+        printf("\nCompleted.\n\n");
+
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,340 @@
+#include "libobj2tsr3.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+using namespace obj2tsr3;
+using std::literals::string_literals::operator""s;
+
+// Failed checks of all tests, a test goes on after a failed check
+size_t failed_checks = 0;
+
+void Check(bool condition, const char* text, const char* file, int line) {
+    if (condition) return;
+
+    printf("  %s(%d): Check failed: %s\n", file, line, text);
+    failed_checks++;
+}
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+std::string ReadFile(const fs::path& path) {
+    std::ifstream ifs(path, std::ifstream::binary);
+    if (!ifs.good()) throw std::runtime_error("Cannot open \""s + path.string() + "\""s);
+
+    std::ostringstream content;
+    content << ifs.rdbuf();
+
+    return content.str();
+}
+
+// Flat shaded cube made of a grid of n x n quads per face, every face with its own normal and
+// vertices, so that vertices on cube edges share their position. Faces alternate between two
+// materials, or are all of the first one
+std::string CubeGridObj(size_t n, bool two_materials = true) {
+    std::ostringstream obj;
+    obj << "mtllib cube.mtl\n";
+
+    for (size_t face = 0; face < 6; face++) {
+        size_t axis = face / 2;
+        float sign = face % 2 ? -1.0f : 1.0f;
+        size_t first = face * (n + 1) * (n + 1) + 1;
+
+        for (size_t j = 0; j <= n; j++) {
+            for (size_t i = 0; i <= n; i++) {
+                float p[3];
+                p[axis] = sign;
+                p[(axis + 1) % 3] = (float)i / n * 2 - 1;
+                p[(axis + 2) % 3] = (float)j / n * 2 - 1;
+
+                obj << "v " << p[0] << " " << p[1] << " " << p[2] << "\n";
+                obj << "vt " << (float)i / n << " " << (float)j / n << "\n";
+            }
+        }
+
+        float normal[3] = {};
+        normal[axis] = sign;
+        obj << "vn " << normal[0] << " " << normal[1] << " " << normal[2] << "\n";
+
+        obj << "usemtl " << (two_materials && face % 2 ? "side" : "top") << "\n";
+
+        for (size_t j = 0; j < n; j++) {
+            for (size_t i = 0; i < n; i++) {
+                size_t quad[4] = {
+                    first + j * (n + 1) + i,
+                    first + j * (n + 1) + i + 1,
+                    first + (j + 1) * (n + 1) + i + 1,
+                    first + (j + 1) * (n + 1) + i,
+                };
+
+                // Counter-clockwise seen from outside
+                if (sign < 0) std::swap(quad[1], quad[3]);
+
+                for (const size_t* triangle : { quad, quad + 1 }) {
+                    size_t corners[3] = { quad[0], triangle[1], triangle[2] };
+
+                    obj << "f";
+                    for (const auto v : corners) obj << " " << v << "/" << v << "/" << face + 1;
+                    obj << "\n";
+                }
+            }
+        }
+    }
+
+    return obj.str();
+}
+
+const char* cube_mtl = "newmtl top\nmap_Kd top.png\nnewmtl side\nmap_Kd side.png\n";
+
+// OBJ floats read as istream >> float reads them
+void TestFloatParsing(const fs::path&) {
+    LineCursor ls("1.5 -2 +3e2 .25 inf -infinity nan 0x10 1e60 -1e60 abc 7");
+
+    const float max = std::numeric_limits<float>::max();
+    const float expected[] = { 1.5f, -2.0f, 300.0f, 0.25f, 0.0f, 0.0f, 0.0f, 0.0f, max, -max, 0.0f, 7.0f };
+
+    for (const auto value : expected)
+        CHECK(ls.Float() == value);
+
+    CHECK(ls.Float() == 0.0f);
+}
+
+// Triangle count of an IA file of revision 3
+size_t IATriangles(const std::string& ia) {
+    uint32_t header[8];
+    if (ia.size() < sizeof(header)) throw std::runtime_error("Not an IA file");
+
+    std::memcpy(header, ia.data(), sizeof(header));
+    return header[6] / 3;
+}
+
+// A flat shaded cube keeps its shape with two triangles per face, its edges are uv / normal
+// seams that must collapse along themselves. Only the cube corners stay in place
+void TestFlatShadedLod(const fs::path&) {
+    ConvertOptions options;
+    options.lod_ratios = { 0.1f, 0.01f };
+
+    auto LoadMtl = [](const std::string&) { return std::string(cube_mtl); };
+    Log log(true);
+
+    ConvertedModel converted = ConvertObjToMemory(CubeGridObj(8, false), LoadMtl, "cube", options, log);
+
+    CHECK(IATriangles(converted.files.at("top.ia8")) == 768);
+    CHECK(IATriangles(converted.files.at("top.lod1.ia8")) <= 76);
+    CHECK(IATriangles(converted.files.at("top.lod2.ia8")) == 12);
+}
+
+// Converts the cube into a data directory as the CLI does, packs the TMDL and its files, then reads
+// the archive back. Every section must be the file it was packed from, byte for byte, and every
+// file the TMDL refers to must be a section
+void TestArchiveRoundTrip(const fs::path& work_path) {
+    const std::string model_name = "cube";
+
+    fs::path data_path = work_path / fs::path(model_name);
+    fs::create_directories(data_path);
+
+    ConvertOptions options;
+    options.vertex_format = VertexFormat::Q16;
+    options.lod_ratios = { 0.5f };
+    options.build_bvh = true;
+    options.build_meshlets = true;
+
+    std::string obj = CubeGridObj(8);
+    auto LoadMtl = [](const std::string&) { return std::string(cube_mtl); };
+
+    std::vector<fs::path> files;
+    Log log(true);
+
+    auto materials = ConvertObj(obj, LoadMtl, [&](const std::string& file_name, const OutputWriter& write) {
+        fs::path path = data_path / fs::path(file_name);
+
+        std::ofstream ofs(path, std::ofstream::binary);
+        write(ofs);
+        if (!ofs.good()) throw std::runtime_error("Cannot write \""s + path.string() + "\""s);
+
+        files.push_back(path);
+    }, options, log, data_path);
+
+    nlohmann::json tmdl;
+    UpdateTMDL(tmdl, model_name, materials, options);
+
+    fs::path tmdl_path = work_path / fs::path(model_name + ".tmdl"s);
+    {
+        std::ofstream ofs(tmdl_path);
+        ofs << std::setw(4) << tmdl;
+    }
+
+    std::vector<std::pair<std::string, fs::path>> archive_files;
+    archive_files.push_back({ model_name + ".tmdl"s, tmdl_path });
+
+    for (const auto& file : files)
+        archive_files.push_back({ model_name + "/"s + file.filename().string(), file });
+
+    fs::path archive_path = work_path / fs::path(model_name + ".tpk"s);
+    CreateArchive(archive_path, archive_files, archive_alignment);
+
+    {
+        Archive archive(archive_path);
+        CHECK(archive.Sections().size() == archive_files.size());
+
+        for (const auto& file : archive_files)
+            CHECK(archive.Section(file.first) == ReadFile(file.second));
+
+        // Sections at aligned offsets from the start of the file
+        std::string_view first_section = archive.Section(archive_files[0].first);
+        for (const auto& section : archive.Sections())
+            CHECK((size_t)(section.second.data() - first_section.data()) % archive_alignment == 0);
+
+        std::vector<std::string> references = { tmdl["collision"], tmdl["collision_bvh"] };
+        for (const auto& draw : tmdl["draw"]) {
+            references.push_back(draw["mesh"]);
+            if (draw.contains("lods"))
+                for (const auto& lod : draw["lods"]) references.push_back(lod);
+        }
+
+        for (const auto& reference : references)
+            CHECK(archive.Sections().count(reference) == 1);
+    }
+
+    // The in-memory conversion makes the same files
+    ConvertedModel converted = ConvertObjToMemory(obj, LoadMtl, model_name, options, log);
+    CHECK(converted.files.size() == files.size());
+    CHECK(converted.tmdl == tmdl);
+
+    for (const auto& file : files) {
+        auto memory_file = converted.files.find(file.filename().string());
+        CHECK(memory_file != converted.files.end() && memory_file->second == ReadFile(file));
+    }
+}
+
+// Archive with a safe entry and hostile ones that would be extracted outside the current directory.
+// Only the safe one gets a path to extract to
+void TestHostileArchive(const fs::path& work_path) {
+    fs::path content_path = work_path / fs::path("content.bin");
+    {
+        std::ofstream ofs(content_path, std::ofstream::binary);
+        ofs << "content";
+    }
+
+    const std::vector<std::string> hostile_names = { "../escape.bin", "model/../../escape.bin", "/tmp/escape.bin", "//server/escape.bin", "model/..", "", "C:escape.bin" };
+
+    std::vector<std::pair<std::string, fs::path>> archive_files = { { "model/./mesh.ia8", content_path } };
+    for (const auto& name : hostile_names) archive_files.push_back({ name, content_path });
+
+    fs::path archive_path = work_path / fs::path("hostile.tpk");
+    CreateArchive(archive_path, archive_files, archive_alignment);
+
+    Archive archive(archive_path);
+    CHECK(archive.Sections().size() == archive_files.size());
+    CHECK(ArchiveEntryPath("model/./mesh.ia8") == fs::path("model/mesh.ia8"));
+
+    for (const auto& name : hostile_names) {
+        CHECK(archive.Section(name) == "content");
+
+        // Drive relative names only have a root on Windows, elsewhere they are plain file names
+        if (name == "C:escape.bin" && !fs::path(name).has_root_name()) continue;
+
+        bool rejected = false;
+        try {
+            ArchiveEntryPath(name);
+        } catch (const std::runtime_error&) {
+            rejected = true;
+        }
+
+        CHECK(rejected);
+    }
+}
+
+// Converts the cube, then converts it again with the cache after moving a vertex of the last face,
+// which is of the "side" material. Only the files of that material and of the collision are
+// written again, and the files end up as a conversion without the cache makes them
+void TestWarmReconvert(const fs::path&) {
+    ConvertOptions options;
+    options.lod_ratios = { 0.5f };
+    options.build_bvh = true;
+    options.build_meshlets = true;
+
+    auto LoadMtl = [](const std::string&) { return std::string(cube_mtl); };
+    Log log(true);
+
+    std::map<std::string, std::string> files;
+    std::vector<std::string> written;
+
+    auto Output = [&](const std::string& file_name, const OutputWriter& write) {
+        std::ostringstream stream(std::ios::binary);
+        write(stream);
+
+        files[file_name] = stream.str();
+        written.push_back(file_name);
+    };
+
+    std::string obj = CubeGridObj(8);
+
+    ConvertCache cache;
+    ConvertObj(obj, LoadMtl, Output, options, log, {}, nullptr, &cache);
+    CHECK(cache.Files() == written);
+
+    size_t last_vertex = obj.rfind("\nv ") + 1;
+    obj.replace(last_vertex, obj.find('\n', last_vertex) - last_vertex, "v -1 -1.1 -1");
+
+    written.clear();
+    ConvertObj(obj, LoadMtl, Output, options, log, {}, nullptr, &cache);
+
+    const std::vector<std::string> changed = { "side.lod1.ia8", "side.ia8", "side.meshlets", "collision.ia3", "collision.bvh" };
+    CHECK(written == changed);
+
+    ConvertedModel converted = ConvertObjToMemory(obj, LoadMtl, "cube", options, log);
+    CHECK(converted.files == files);
+
+    std::vector<std::string> cold_files;
+    for (const auto& file : converted.files) cold_files.push_back(file.first);
+
+    std::vector<std::string> cache_files = cache.Files();
+    std::sort(cache_files.begin(), cache_files.end());
+    CHECK(cache_files == cold_files);
+}
+
+int main() {
+    printf("OBJ2TSR3 | Tests\n================\n");
+
+    fs::path work_path = fs::temp_directory_path() / fs::path("obj2tsr3_test");
+
+    const std::pair<const char*, void (*)(const fs::path&)> tests[] = {
+        { "FloatParsing", TestFloatParsing },
+        { "FlatShadedLod", TestFlatShadedLod },
+        { "ArchiveRoundTrip", TestArchiveRoundTrip },
+        { "HostileArchive", TestHostileArchive },
+        { "WarmReconvert", TestWarmReconvert },
+    };
+
+    size_t failed_tests = 0;
+
+    for (const auto& test : tests) {
+        printf("%-40s\n", test.first);
+        size_t failed_before = failed_checks;
+
+        try {
+            std::error_code ec;
+            fs::remove_all(work_path, ec);
+            fs::create_directories(work_path);
+
+            test.second(work_path);
+        } catch (const std::exception& ex) {
+            printf("  Error: %s\n", ex.what());
+            failed_checks++;
+        }
+
+        if (failed_checks != failed_before) failed_tests++;
+    }
+
+    std::error_code ec;
+    fs::remove_all(work_path, ec);
+
+    printf("\n%zu of %zu tests failed\n\n", failed_tests, std::size(tests));
+
+    return failed_tests ? EXIT_FAILURE : EXIT_SUCCESS;
+}